@@ -10,11 +10,39 @@ LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/include
 LOCAL_CFLAGS := -DARAW_API_EXPORTS -fvisibility=hidden -std=gnu99
 LOCAL_SRC_FILES := \
 	src/araw.c \
+	src/araw_cache.c \
+	src/araw_convert.c \
+	src/araw_io.c \
+	src/araw_process.c \
 	src/araw_reader.c \
-	src/araw_writer.c
+	src/araw_ring.c \
+	src/araw_segment.c \
+	src/araw_uring.c \
+	src/araw_writer.c \
+	src/araw_writer_group.c
+
+LOCAL_LDLIBS := -lm
 
 LOCAL_LIBRARIES := \
 	libaudio-defs \
 	libulog
 
+LOCAL_CONDITIONAL_LIBRARIES := \
+	OPTIONAL:liburing
+
 include $(BUILD_LIBRARY)
+
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := araw-bench
+LOCAL_CATEGORY_PATH := multimedia
+LOCAL_DESCRIPTION := Raw audio library reader and writer benchmark
+LOCAL_SRC_FILES := tools/araw_bench.c
+LOCAL_LDLIBS := -lm
+LOCAL_LIBRARIES := \
+	libaudio-defs \
+	libaudio-raw \
+	libulog
+
+include $(BUILD_EXECUTABLE)
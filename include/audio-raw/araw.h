@@ -27,7 +27,9 @@
 #ifndef _ARAW_H_
 #define _ARAW_H_
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <audio-defs/adefs.h>
@@ -51,6 +53,174 @@ extern "C" {
 /* Forward declarations */
 struct araw_reader;
 struct araw_writer;
+struct araw_writer_group;
+
+
+/* Sample format, used for sample conversion */
+enum araw_sample_format {
+	/* Unknown or unchanged sample format */
+	ARAW_SAMPLE_FORMAT_UNKNOWN = 0,
+
+	/* Unsigned 8-bit integer */
+	ARAW_SAMPLE_FORMAT_U8,
+
+	/* Signed 8-bit integer */
+	ARAW_SAMPLE_FORMAT_S8,
+
+	/* Signed 16-bit integer */
+	ARAW_SAMPLE_FORMAT_S16,
+
+	/* Signed 24-bit integer, packed on 3 bytes */
+	ARAW_SAMPLE_FORMAT_S24,
+
+	/* Signed 32-bit integer */
+	ARAW_SAMPLE_FORMAT_S32,
+
+	/* 32-bit IEEE 754 floating point, full scale is [-1.0, 1.0] */
+	ARAW_SAMPLE_FORMAT_F32,
+
+	/* 64-bit IEEE 754 floating point, full scale is [-1.0, 1.0] */
+	ARAW_SAMPLE_FORMAT_F64,
+};
+
+
+/* Reader seek mode */
+enum araw_seek_mode {
+	/* Seek to a frame index */
+	ARAW_SEEK_MODE_FRAME = 0,
+
+	/* Seek to a sample offset */
+	ARAW_SEEK_MODE_SAMPLE,
+
+	/* Seek to a timestamp in the reader timescale */
+	ARAW_SEEK_MODE_TIMESTAMP,
+};
+
+
+/* RIFF chunk identifier */
+#define ARAW_FOURCC(a, b, c, d)                                                \
+	((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 |            \
+	 (uint32_t)(d) << 24)
+
+
+/* WAVE file chunk */
+struct araw_chunk {
+	/* Chunk identifier (see ARAW_FOURCC()) */
+	uint32_t id;
+
+	/* Offset of the chunk content in the file */
+	uint64_t offset;
+
+	/* Size of the chunk content in bytes (from the ds64 chunk in
+	 * RF64/BW64 files for the data chunk) */
+	uint64_t size;
+};
+
+
+/* Number of latency histogram buckets */
+#define ARAW_LATENCY_BUCKET_COUNT 32
+
+
+/* Latency statistics, in nanoseconds */
+struct araw_latency_stats {
+	/* Number of measures */
+	uint64_t count;
+
+	/* Minimum, maximum and sum of the latencies (the average is
+	 * total / count) */
+	uint64_t min;
+	uint64_t max;
+	uint64_t total;
+
+	/* Histogram: bucket i counts the latencies in [2^i, 2^(i+1)[ ns,
+	 * the last bucket also counts the longer ones */
+	uint64_t buckets[ARAW_LATENCY_BUCKET_COUNT];
+};
+
+
+/* Reader statistics */
+struct araw_reader_stats {
+	/* Bytes read from the file, or from the mapping in mmap mode */
+	uint64_t bytes;
+
+	/* Frames read or borrowed */
+	uint64_t frames;
+
+	/* I/O calls (system calls or I/O callbacks), including seeks */
+	uint64_t io_calls;
+
+	/* Seeks */
+	uint64_t seeks;
+
+	/* Reads returning less than requested */
+	uint64_t short_reads;
+
+	/* araw_reader_frame_read(), araw_reader_frames_read() and
+	 * araw_reader_frame_borrow() latency */
+	struct araw_latency_stats frame_read;
+};
+
+
+/* Writer statistics */
+struct araw_writer_stats {
+	/* Bytes written to the file, including the headers */
+	uint64_t bytes;
+
+	/* Frames written (queued in asynchronous mode) */
+	uint64_t frames;
+
+	/* I/O calls (system calls or I/O callbacks), including seeks */
+	uint64_t io_calls;
+
+	/* Seeks */
+	uint64_t seeks;
+
+	/* Writes returning less than requested */
+	uint64_t short_writes;
+
+	/* araw_writer_frame_write() latency */
+	struct araw_latency_stats frame_write;
+
+	/* WAVE header updates (checkpoints and file-close) latency */
+	struct araw_latency_stats header_write;
+
+	/* Asynchronous mode: frames dropped because the queue was full */
+	uint64_t overruns;
+
+	/* Asynchronous mode: maximum number of frames in the queue */
+	unsigned int queue_max;
+};
+
+
+/* Writer group configuration */
+struct araw_writer_group_config {
+	/* Maximum number of queued frames of a writer written at once, in a
+	 * single write, before moving on to the next writer (optional, 0
+	 * for the default) */
+	unsigned int quantum;
+};
+
+
+/* I/O callbacks, used instead of a file; all functions return a negative
+ * errno value in case of error */
+struct araw_io_ops {
+	/* Read up to len bytes into buf; returns the number of bytes read,
+	 * 0 at end of stream (mandatory for readers) */
+	ssize_t (*read)(void *userdata, void *buf, size_t len);
+
+	/* Write up to len bytes from buf; returns the number of bytes
+	 * written (mandatory for writers) */
+	ssize_t (*write)(void *userdata, const void *buf, size_t len);
+
+	/* Move to offset bytes relative to whence (SEEK_SET, SEEK_CUR or
+	 * SEEK_END); returns 0 on success (optional for readers, seeking is
+	 * then not supported; mandatory for writers, to fill the WAVE header
+	 * sizes) */
+	int (*seek)(void *userdata, int64_t offset, int whence);
+
+	/* Get the current position in bytes (optional) */
+	int64_t (*tell)(void *userdata);
+};
 
 
 /* Frame data */
@@ -73,23 +243,250 @@ struct araw_frame {
 
 /* Reader configuration */
 struct araw_reader_config {
-	int data_length;
+	/* Length of the PCM data in bytes (raw mode: optional, 0 to read up
+	 * to the end of the file or stream; filled by the reader) */
+	uint64_t data_length;
 
 	/* Raw format (can be empty for wav files, mandatory otherwise) */
 	struct adef_format format;
 
-	/* WAVE file format */
+	/* WAVE file format (raw mode: optional, WAVE_FORMAT_IEEE_FLOAT
+	 * (0x0003) for floating point samples, integer PCM otherwise;
+	 * filled by the reader) */
 	enum adef_wave_format wave_format;
 
+	/* Raw mode: the file is headerless PCM data in the given raw
+	 * format */
+	bool raw;
+
+	/* Raw mode: offset in bytes of the PCM data from the start of the
+	 * file, or from the current position of the file descriptor */
+	uint64_t raw_offset;
+
 	/* Number of samples per frame */
 	unsigned int frame_length;
+
+	/* Map the file in memory; frames can then be borrowed without copy
+	 * using araw_reader_frame_borrow() */
+	bool mmap;
+
+	/* Prefetch mode: number of frames read ahead by the reader thread
+	 * (0 to read synchronously from araw_reader_frame_read(); not
+	 * compatible with mmap) */
+	unsigned int prefetch_depth;
+
+	/* Output sample format; samples are converted from the file sample
+	 * format, in host endianness (optional, ARAW_SAMPLE_FORMAT_UNKNOWN
+	 * to output the file samples unchanged; filled by the reader) */
+	enum araw_sample_format sample_format;
+
+	/* Output planar (non-interleaved) frames: the samples of each channel
+	 * are stored in a separate plane; the planes of a frame are
+	 * cdata_length / channel_count bytes apart */
+	bool planar;
+
+	/* Planar mode: alignment in bytes of the planes, power of 2 (0 for
+	 * the default 64 bytes); the buffers given to the reader must be
+	 * aligned accordingly */
+	unsigned int planar_align;
+
+	/* Speaker position of each channel, as SPEAKER_* bits of the
+	 * WAVE_FORMAT_EXTENSIBLE channel mask (filled by the reader, 0 if
+	 * not specified in the file) */
+	uint32_t channel_mask;
+
+	/* Number of significant bits in each file sample, at most the bit
+	 * depth (filled by the reader) */
+	unsigned int valid_bits;
+
+	/* Timescale of the frame timestamps in Hz (optional, 0 for the
+	 * default 1000000, i.e. microseconds; the sample rate gives exact
+	 * timestamps). Timestamps are computed from the number of samples
+	 * read, rounded to nearest, so that no error accumulates */
+	uint32_t timescale;
+
+	/* Timestamp of the first sample, in the timescale (optional) */
+	uint64_t start_timestamp;
+
+	/* Number of frame buffers pre-allocated by the reader (optional, 0
+	 * for none); frames can then be borrowed from this pool using
+	 * araw_reader_frame_borrow() when they cannot be borrowed from the
+	 * mapped file, without any allocation while reading. The buffers are
+	 * aligned on a cache line (or planar_align if larger) */
+	unsigned int pool_size;
+
+	/* Look up the parsed WAVE header in a process-wide cache, keyed by
+	 * the file name, device, inode, size and modification time, so that
+	 * files opened again are not parsed again (araw_reader_new() only;
+	 * see araw_reader_cache_clear()) */
+	bool header_cache;
+
+	/* Read the file through an io_uring ring shared by the process, with
+	 * asynchronous read-ahead (araw_reader_new() only; falls back to
+	 * pread() when io_uring is not available; not compatible with
+	 * mmap) */
+	bool uring;
+
+	/* Paced mode: the frames are due at the real-time rate on the
+	 * monotonic clock, the first one on the first read; frame reads
+	 * return -EAGAIN until the next frame is due, which is signaled by
+	 * the file descriptor given by araw_reader_get_fd(). The due times
+	 * are computed from the first one, so that the pace does not drift:
+	 * late frames are due at once */
+	bool paced;
+
+	/* Paced mode: speed factor, e.g. 2 to read twice as fast as real
+	 * time (0 for real time; filled by the reader) */
+	float speed;
+
+	/* Loop mode: once at the end, read the data again from the start,
+	 * without any gap; the frame indexes and timestamps go on. The whole
+	 * data chunk is loaded in memory when the reader is created (not
+	 * compatible with mmap); the data length must be known, so raw
+	 * streams require data_length */
+	bool loop;
 };
 
 
+/* Segmented mode: function called when a segment file is complete, with
+ * the segment file name and index */
+typedef void (*araw_writer_segment_fn_t)(struct araw_writer *writer,
+					 const char *filename,
+					 unsigned int index,
+					 void *userdata);
+
+
 /* Writer configuration */
 struct araw_writer_config {
 	/* Data format (mandatory) */
 	struct adef_format format;
+
+	/* Asynchronous mode: number of pre-allocated frame buffers in the
+	 * queue drained by the writer thread (0 to write synchronously from
+	 * araw_writer_frame_write()) */
+	unsigned int async_depth;
+
+	/* Asynchronous mode: size in bytes of each frame buffer (mandatory
+	 * if async_depth is not 0) */
+	size_t async_buf_size;
+
+	/* Asynchronous mode: writer group whose scheduler thread drains the
+	 * queue instead of a writer thread (optional, can be NULL); the
+	 * group must outlive the writer */
+	struct araw_writer_group *group;
+
+	/* Input sample format; the samples of the frames are converted to
+	 * the data format before being written (optional,
+	 * ARAW_SAMPLE_FORMAT_UNKNOWN if the frames are already in the data
+	 * format). When set, the frame format channel count, sample rate and
+	 * layout must match the data format, and its bit depth, signedness
+	 * and endianness must describe the input samples (floating point
+	 * samples are in host endianness) */
+	enum araw_sample_format input_sample_format;
+
+	/* Number of samples per frame for planar (non-interleaved) input
+	 * frames whose planes are padded, e.g. for alignment (optional, 0 if
+	 * the planes are contiguous); planar input frames are interleaved
+	 * before being written, their planes are cdata_length /
+	 * channel_count bytes apart */
+	unsigned int frame_length;
+
+	/* Data sample format (optional, ARAW_SAMPLE_FORMAT_UNKNOWN for
+	 * integer PCM samples as described by the data format); floating
+	 * point sample formats are stored as IEEE float. When set, the data
+	 * format bit depth and signedness are updated accordingly */
+	enum araw_sample_format sample_format;
+
+	/* Speaker position of each channel, as SPEAKER_* bits of the
+	 * WAVE_FORMAT_EXTENSIBLE channel mask (optional, 0 if not
+	 * specified) */
+	uint32_t channel_mask;
+
+	/* Number of significant bits in each sample, at most the bit depth
+	 * (optional, 0 if all bits are significant) */
+	unsigned int valid_bits;
+
+	/* Size in bytes of the aggregation buffer, rounded up to the page
+	 * size (optional, 0 to write through stdio buffering); data is
+	 * written to the file only when the buffer is full, in a single
+	 * write_buf_size bytes write at an aligned position. A frame write
+	 * thus issues at most one write per write_buf_size bytes of frame
+	 * data, and at most one if the frame is smaller than the buffer;
+	 * the rest of the buffer is written on file-close */
+	size_t write_buf_size;
+
+	/* Bypass the page cache using O_DIRECT (requires write_buf_size; the
+	 * buffer size must be a multiple of the device block size) */
+	bool direct_io;
+
+	/* Preallocate the file space with fallocate() in chunks of this size
+	 * in bytes, ahead of the data, to limit fragmentation (optional, 0
+	 * to disable); the unused space is released on file-close */
+	uint64_t prealloc_size;
+
+	/* Update the WAVE header sizes every checkpoint_bytes bytes of data
+	 * and/or every checkpoint_ms milliseconds (optional, 0 to disable);
+	 * the data is synced to the storage first, so that a file truncated
+	 * by a crash remains valid up to the last checkpoint */
+	uint64_t checkpoint_bytes;
+	unsigned int checkpoint_ms;
+
+	/* Write the file through an io_uring ring shared by the process, the
+	 * data being aggregated into blocks written asynchronously
+	 * (araw_writer_new() only; falls back to pwrite() when io_uring is
+	 * not available; features relying on a stdio file, i.e.
+	 * write_buf_size, direct_io, prealloc_size, checkpoint_bytes and
+	 * checkpoint_ms, are not supported) */
+	bool uring;
+
+	/* Segmented mode: roll to a new file every segment_bytes bytes of
+	 * data and/or every segment_ms milliseconds of audio, whichever
+	 * comes first (optional, 0 to disable; araw_writer_new() only). Each
+	 * segment is a complete WAVE file, split on a sample boundary, named
+	 * after the file name with a "_NNNN" index inserted before the
+	 * extension */
+	uint64_t segment_bytes;
+	unsigned int segment_ms;
+
+	/* Segmented mode: function called when a segment is complete,
+	 * including the last one on araw_writer_destroy(), from the thread
+	 * writing the data (optional, can be NULL) */
+	araw_writer_segment_fn_t segment_done;
+	void *segment_userdata;
+};
+
+
+/* Segment processing function; called concurrently from several threads,
+ * on segments in any order. The input holds count samples (per channel) in
+ * the reader output format and layout; the output must be filled with
+ * count samples (per channel) in the output format (if any). count is the
+ * segment length except for the last segment; in planar layouts, the
+ * planes are always segment length samples apart. Returns 0 on success,
+ * negative errno value in case of error */
+typedef int (*araw_process_fn_t)(const uint8_t *in,
+				 uint8_t *out,
+				 size_t count,
+				 uint64_t offset,
+				 void *userdata);
+
+
+/* Parallel processing configuration */
+struct araw_process_config {
+	/* Number of worker threads (optional, 0 for the number of online
+	 * CPUs) */
+	unsigned int thread_count;
+
+	/* Segment length in samples per channel (optional, 0 for the
+	 * default 65536) */
+	size_t segment_length;
+
+	/* Output format, as given to the writer (ignored without
+	 * writer) */
+	struct adef_format out_format;
+
+	/* Processing function (mandatory) and its user data */
+	araw_process_fn_t process;
+	void *userdata;
 };
 
 
@@ -109,6 +506,94 @@ ARAW_API int araw_reader_new(const char *filename,
 			     struct araw_reader **ret_obj);
 
 
+/**
+ * Create a reader instance from a file descriptor.
+ * The file descriptor can be a regular file, a pipe or a named FIFO, e.g.
+ * to stream from stdin; data is read from its current position. On pipes,
+ * the offset is skipped by reading and seeking is not supported.
+ * The file descriptor is duplicated: the caller keeps its ownership and
+ * can close it once the instance is created.
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_reader_destroy() function.
+ * @param fd: file descriptor opened for reading
+ * @param config: reader configuration
+ * @param ret_obj: reader instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_new_from_fd(int fd,
+				     const struct araw_reader_config *config,
+				     struct araw_reader **ret_obj);
+
+
+/**
+ * Create a reader instance over I/O callbacks.
+ * Features relying on a file descriptor (mmap) are not supported and return
+ * -EOPNOTSUPP.
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_reader_destroy() function.
+ * @param ops: I/O callbacks, must remain valid for the instance lifetime
+ * @param userdata: I/O callbacks user data
+ * @param config: reader configuration
+ * @param ret_obj: reader instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_new_from_io(const struct araw_io_ops *ops,
+				     void *userdata,
+				     const struct araw_reader_config *config,
+				     struct araw_reader **ret_obj);
+
+
+/**
+ * Create a reader instance over a list of segment files.
+ * The segments are WAVE files with the same format, for example written by
+ * a writer in segmented mode; their data is read in the given order as a
+ * single stream, with continuous frame indexes and timestamps. The format
+ * is taken from the files (the raw mode options are ignored). Features
+ * relying on a file descriptor (mmap and range reads) are not supported
+ * and return -EOPNOTSUPP.
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_reader_destroy() function.
+ * @param filenames: segment file names, in order
+ * @param count: number of segments
+ * @param config: reader configuration
+ * @param ret_obj: reader instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_new_segments(const char *const *filenames,
+				      unsigned int count,
+				      const struct araw_reader_config *config,
+				      struct araw_reader **ret_obj);
+
+
+/**
+ * Create a reader instance over a memory region.
+ * The region holds the file content (or the raw data in raw mode) and must
+ * remain valid and unchanged for the instance lifetime. Frames are given
+ * from the region as in mmap mode (which is implied), and can be borrowed
+ * without copy using araw_reader_frame_borrow(), except in loop mode where
+ * they are copied; prefetch mode is not supported.
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_reader_destroy() function.
+ * @param data: memory region
+ * @param len: memory region size in bytes
+ * @param config: reader configuration
+ * @param ret_obj: reader instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_new_from_buffer(const uint8_t *data,
+					 size_t len,
+					 const struct araw_reader_config *config,
+					 struct araw_reader **ret_obj);
+
+
 /**
  * Free a reader instance.
  * This function frees all resources associated with a reader instance.
@@ -129,6 +614,65 @@ ARAW_API int araw_reader_get_config(struct araw_reader *self,
 				    struct araw_reader_config *config);
 
 
+/**
+ * Get the chunk directory.
+ * The directory lists the chunks of a WAVE file up to the data chunk
+ * (included), in file order; it is empty in raw mode. The array remains
+ * valid for the instance lifetime.
+ * @param self: reader instance handle
+ * @param chunks: chunk array (output)
+ * @param count: number of chunks in the array (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_get_chunks(struct araw_reader *self,
+				    const struct araw_chunk **chunks,
+				    unsigned int *count);
+
+
+/**
+ * Find a chunk in the chunk directory.
+ * @param self: reader instance handle
+ * @param id: chunk identifier (see ARAW_FOURCC())
+ * @param chunk: first chunk with the given identifier (output)
+ * @return 0 on success, negative errno value in case of error (-ENOENT if
+ *         no chunk has the given identifier)
+ */
+ARAW_API int araw_reader_find_chunk(struct araw_reader *self,
+				    uint32_t id,
+				    const struct araw_chunk **chunk);
+
+
+/**
+ * Read the content of a chunk.
+ * Reads up to len bytes of the chunk content from the given offset, without
+ * changing the position of the next frame read; like
+ * araw_reader_read_range(), this function can be called concurrently from
+ * several threads, and only readers over a file or a memory buffer are
+ * supported (-EOPNOTSUPP otherwise, and in loop mode for readers over a
+ * file, whose chunks are not kept in memory).
+ * @param self: reader instance handle
+ * @param chunk: chunk from the chunk directory
+ * @param offset: offset in the chunk content
+ * @param data: pointer on the buffer to fill
+ * @param len: buffer size
+ * @return the number of bytes read on success, negative errno value in case
+ *         of error
+ */
+ARAW_API ssize_t araw_reader_chunk_read(struct araw_reader *self,
+					const struct araw_chunk *chunk,
+					uint64_t offset,
+					uint8_t *data,
+					size_t len);
+
+
+/**
+ * Clear the process-wide WAVE header cache.
+ * Frees all the headers cached by the readers created with the header_cache
+ * configuration option.
+ */
+ARAW_API void araw_reader_cache_clear(void);
+
+
 /**
  * Get the minimum buffer size for reading a frame.
  * @param self: reader instance handle
@@ -141,11 +685,17 @@ ARAW_API ssize_t araw_reader_get_min_buf_size(struct araw_reader *self);
  * Read a frame.
  * Reads a frame from the file into the provided data buffer.
  * The frame structure is filled by the function with the frame metadata.
+ * In prefetch mode, the frame is copied from the frames already read ahead
+ * by the reader thread; this function never blocks and returns -EAGAIN if
+ * no frame is available yet.
+ * In paced mode, -EAGAIN is returned until the frame is due (see
+ * araw_reader_get_fd()).
  * @param self: reader instance handle
  * @param data: pointer on the buffer to fill
  * @param len: buffer size
  * @param frame: frame metadata (output)
- * @return 0 on success, negative errno value in case of error
+ * @return 0 on success, negative errno value in case of error (-ENOENT at
+ *         end of file)
  */
 ARAW_API int araw_reader_frame_read(struct araw_reader *self,
 				    uint8_t *data,
@@ -153,6 +703,146 @@ ARAW_API int araw_reader_frame_read(struct araw_reader *self,
 				    struct araw_frame *frame);
 
 
+/**
+ * Read several frames.
+ * Reads up to count consecutive frames from the file into the provided data
+ * buffer in a single I/O operation. The frames are stored contiguously in
+ * the buffer; each frame structure is filled by the function with its data
+ * pointer and its frame metadata.
+ * In paced mode, only the frames already due are read (-EAGAIN if none).
+ * @param self: reader instance handle
+ * @param data: pointer on the buffer to fill
+ * @param len: buffer size
+ * @param frames: array of frames (output)
+ * @param count: number of frames in the array
+ * @return the number of frames read on success, negative errno value in case
+ *         of error (-ENOENT at end of file)
+ */
+ARAW_API int araw_reader_frames_read(struct araw_reader *self,
+				     uint8_t *data,
+				     size_t len,
+				     struct araw_frame *frames,
+				     unsigned int count);
+
+
+/**
+ * Read a range of samples at any position.
+ * Reads up to count samples (per channel) starting at the given sample
+ * offset, without changing the position of the next frame read. The
+ * samples are converted to the output sample format and layout; in planar
+ * mode, the planes are contiguous (count samples apart, planar_align is
+ * not applied).
+ * This function uses positional reads and does not modify the reader: it
+ * can be called concurrently from several threads on the same reader, and
+ * concurrently with the other reader functions. Only readers over a file
+ * or a memory buffer are supported (-EOPNOTSUPP otherwise). The data read
+ * is not accounted in the reader statistics.
+ * @param self: reader instance handle
+ * @param offset: offset of the first sample, from the start of the data
+ * @param count: number of samples (per channel) to read
+ * @param data: pointer on the buffer to fill
+ * @param len: buffer size
+ * @return the number of samples (per channel) read on success, less than
+ *         count at end of file, negative errno value in case of error
+ *         (-ENOENT if the offset is at or beyond the end of file)
+ */
+ARAW_API ssize_t araw_reader_read_range(struct araw_reader *self,
+					uint64_t offset,
+					size_t count,
+					uint8_t *data,
+					size_t len);
+
+
+/**
+ * Get the paced mode file descriptor.
+ * The file descriptor becomes readable when the next frame is due, and
+ * remains readable until the frame is read; it can be added to an event
+ * loop, and must neither be read nor closed by the caller.
+ * @param self: reader instance handle
+ * @return the file descriptor on success, negative errno value in case of
+ *         error (-EPROTO if not in paced mode)
+ */
+ARAW_API int araw_reader_get_fd(struct araw_reader *self);
+
+
+/**
+ * Get the reader statistics.
+ * The statistics are updated without locking and can be read consistently
+ * from any thread.
+ * @param self: reader instance handle
+ * @param stats: reader statistics (output)
+ * @return 0 on success, negative errno value in case of error (-ENOTSUP if
+ *         the library is built without statistics)
+ */
+ARAW_API int araw_reader_get_stats(struct araw_reader *self,
+				   struct araw_reader_stats *stats);
+
+
+/**
+ * Seek to a position in the file.
+ * The position is given either as a frame index, a sample offset or a
+ * timestamp in the reader timescale (including the start timestamp),
+ * depending on the mode. Timestamps are rounded up to the next sample.
+ * The next frame read starts at the requested position; its index and
+ * timestamp are updated accordingly.
+ * @param self: reader instance handle
+ * @param mode: seek mode
+ * @param value: position to seek to (frame index, sample offset or
+ *               timestamp depending on the mode)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_seek(struct araw_reader *self,
+			      enum araw_seek_mode mode,
+			      uint64_t value);
+
+
+/**
+ * Borrow a frame.
+ * Only available when the reader is configured with mmap enabled or with a
+ * frame pool.
+ * The frame structure is filled by the function with the frame metadata.
+ * In mmap mode, when the samples need no conversion, its data pointer
+ * points directly into the mapped file; no copy is made and the data must
+ * not be modified. Otherwise the frame is read as with
+ * araw_reader_frame_read() into a buffer of the frame pool, which can be
+ * modified. The frame is reference counted, starting with one reference;
+ * each reference must be given back using the araw_reader_frame_release()
+ * function before the reader is destroyed.
+ * @param self: reader instance handle
+ * @param frame: frame (output)
+ * @return 0 on success, negative errno value in case of error (-ENOBUFS if
+ *         all the buffers of the pool are in use, -ENOENT at end of file)
+ */
+ARAW_API int araw_reader_frame_borrow(struct araw_reader *self,
+				      struct araw_frame *frame);
+
+
+/**
+ * Add a reference to a borrowed frame.
+ * The frame can then be shared, e.g. between several processing stages,
+ * each one releasing its reference. This function can be called from any
+ * thread.
+ * @param self: reader instance handle
+ * @param frame: borrowed frame
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_frame_ref(struct araw_reader *self,
+				   const struct araw_frame *frame);
+
+
+/**
+ * Release a borrowed frame.
+ * Releases a reference to a frame previously obtained with
+ * araw_reader_frame_borrow(); pool buffers are reused once their last
+ * reference is released. This function can be called from any thread.
+ * @param self: reader instance handle
+ * @param frame: frame to release
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_reader_frame_release(struct araw_reader *self,
+				       struct araw_frame *frame);
+
+
 /**
  * Create a file writer instance.
  * The configuration structure must be filled.
@@ -169,6 +859,53 @@ ARAW_API int araw_writer_new(const char *filename,
 			     struct araw_writer **ret_obj);
 
 
+/**
+ * Create a writer instance over I/O callbacks.
+ * Features relying on a file descriptor (write_buf_size, direct_io,
+ * prealloc_size, checkpoint_bytes and checkpoint_ms) are not supported and
+ * return -EOPNOTSUPP.
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_writer_destroy() function.
+ * @param ops: I/O callbacks, must remain valid for the instance lifetime
+ * @param userdata: I/O callbacks user data
+ * @param config: writer configuration
+ * @param ret_obj: writer instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_writer_new_from_io(const struct araw_io_ops *ops,
+				     void *userdata,
+				     const struct araw_writer_config *config,
+				     struct araw_writer **ret_obj);
+
+
+/**
+ * Create a writer instance over a memory region.
+ * The file content is written to the region; writing fails with -ENOSPC
+ * once it is full. The length of the content is updated on each write and
+ * on araw_writer_destroy(), after which the region holds the complete
+ * file. Features relying on a file descriptor are not supported, as for
+ * araw_writer_new_from_io().
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_writer_destroy() function.
+ * @param data: memory region
+ * @param size: memory region size in bytes
+ * @param len: length in bytes of the file content (output), must remain
+ *             valid for the instance lifetime
+ * @param config: writer configuration
+ * @param ret_obj: writer instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_writer_new_from_buffer(uint8_t *data,
+					 size_t size,
+					 size_t *len,
+					 const struct araw_writer_config *config,
+					 struct araw_writer **ret_obj);
+
+
 /**
  * Free a writer instance.
  * This function frees all resources associated with a writer instance.
@@ -182,6 +919,11 @@ ARAW_API int araw_writer_destroy(struct araw_writer *self);
  * Write a frame.
  * Writes a frame to the file. The profided frame structure must be filled
  * with the frame metadata.
+ * In asynchronous mode, the frame data is copied into the queue and written
+ * to the file later by the writer thread; this function never blocks. If
+ * the queue is full, the frame is dropped, the overrun counter is
+ * incremented and -EAGAIN is returned. Errors from the writer thread are
+ * reported by the next call.
  * @param self: writer instance handle
  * @param frame: frame metadata
  * @return 0 on success, negative errno value in case of error
@@ -190,6 +932,120 @@ ARAW_API int araw_writer_frame_write(struct araw_writer *self,
 				     const struct araw_frame *frame);
 
 
+/**
+ * Write a frame given as several buffers.
+ * Writes the concatenation of the buffers as the data of a frame of the
+ * given format, e.g. samples split by a ring buffer wraparound; the data
+ * can span several whole frames. When the frame needs no conversion, the
+ * buffers are written to the file with a single writev() (or copied into
+ * the aggregation buffer or the queue) without being gathered first.
+ * Otherwise, they are gathered then written as with
+ * araw_writer_frame_write().
+ * @param self: writer instance handle
+ * @param format: frame format
+ * @param iov: buffers
+ * @param iovcnt: number of buffers
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_writer_frame_writev(struct araw_writer *self,
+				      const struct adef_format *format,
+				      const struct iovec *iov,
+				      int iovcnt);
+
+
+/**
+ * Write several frames.
+ * Writes count frames in order; the frames that need no conversion are
+ * written to the file with a single writev() (per 64 frames) in
+ * synchronous mode.
+ * @param self: writer instance handle
+ * @param frames: array of frames
+ * @param count: number of frames in the array
+ * @return the number of frames written on success (less than count if an
+ *         error occurred after the first frame, e.g. -EAGAIN in
+ *         asynchronous mode), negative errno value in case of error
+ */
+ARAW_API int araw_writer_frames_write(struct araw_writer *self,
+				      const struct araw_frame *frames,
+				      unsigned int count);
+
+
+/**
+ * Get the number of frames dropped in asynchronous mode.
+ * @param self: writer instance handle
+ * @param count: number of frames dropped because the queue was full (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int araw_writer_get_overrun_count(struct araw_writer *self,
+					   unsigned int *count);
+
+
+/**
+ * Get the writer statistics.
+ * The statistics are updated without locking and can be read consistently
+ * from any thread.
+ * @param self: writer instance handle
+ * @param stats: writer statistics (output)
+ * @return 0 on success, negative errno value in case of error (-ENOTSUP if
+ *         the library is built without statistics)
+ */
+ARAW_API int araw_writer_get_stats(struct araw_writer *self,
+				   struct araw_writer_stats *stats);
+
+
+/**
+ * Create a writer group instance.
+ * A writer group runs a single scheduler thread draining the queues of the
+ * asynchronous writers created with the group in their configuration,
+ * instead of a thread per writer. The writers are served in turn: the
+ * queued frames of a writer, up to the quantum, are written to its file in
+ * a single write before moving on to the next writer.
+ * The configuration structure must be filled.
+ * The instance handle is returned through the ret_obj parameter.
+ * When no longer needed, the instance must be freed using the
+ * araw_writer_group_destroy() function.
+ * @param config: writer group configuration
+ * @param ret_obj: writer group instance handle (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+ARAW_API int
+araw_writer_group_new(const struct araw_writer_group_config *config,
+		      struct araw_writer_group **ret_obj);
+
+
+/**
+ * Free a writer group instance.
+ * All the writers of the group must have been destroyed first.
+ * @param self: writer group instance handle
+ * @return 0 on success, negative errno value in case of error (-EBUSY if
+ *         writers are still in the group)
+ */
+ARAW_API int araw_writer_group_destroy(struct araw_writer_group *self);
+
+
+/**
+ * Process a file in parallel.
+ * The reader data is split into segments processed by a pool of worker
+ * threads; the processed segments are then written in order through the
+ * writer (if any). The segments are read using araw_reader_read_range():
+ * the reader must be over a file or a memory buffer, and its position is
+ * unchanged. The writer header is completed by araw_writer_destroy(). An
+ * asynchronous writer is retried while its queue is full; the retries are
+ * counted as overruns.
+ * This function returns when all the segments are processed.
+ * @param reader: reader instance handle
+ * @param writer: writer instance handle (optional, can be NULL for
+ *                analysis only)
+ * @param config: processing configuration
+ * @return 0 on success, negative errno value in case of error (the first
+ *         error returned by the processing function, the reader or the
+ *         writer)
+ */
+ARAW_API int araw_process(struct araw_reader *reader,
+			  struct araw_writer *writer,
+			  const struct araw_process_config *config);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -24,8 +24,84 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <audio-raw/araw.h>
+#include "araw_priv.h"
 
 #define ULOG_TAG araw
 #include <ulog.h>
 ULOG_DECLARE_TAG(ULOG_TAG);
+
+
+/* KSDATAFORMAT_SUBTYPE_* GUIDs suffix */
+const uint8_t araw_wave_subformat_suffix[WAVE_SUBFORMAT_SUFFIX_SIZE] = {
+	0x00,
+	0x00,
+	0x00,
+	0x00,
+	0x10,
+	0x00,
+	0x80,
+	0x00,
+	0x00,
+	0xAA,
+	0x00,
+	0x38,
+	0x9B,
+	0x71,
+};
+
+
+bool araw_format_is_supported(const struct adef_format *format,
+			      enum araw_sample_format sample_format)
+{
+	if (format->encoding != ADEF_ENCODING_PCM ||
+	    format->channel_count == 0 || format->sample_rate == 0)
+		return false;
+
+	/* WAVE files are interleaved and little endian */
+	if (!format->pcm.interleaved || !format->pcm.little_endian)
+		return false;
+
+	if (sample_format != ARAW_SAMPLE_FORMAT_UNKNOWN)
+		return format->bit_depth ==
+			       8 * araw_sample_format_size(sample_format) &&
+		       format->pcm.signed_val ==
+			       (sample_format != ARAW_SAMPLE_FORMAT_U8);
+
+	/* 8-bit WAVE samples are unsigned, wider ones are signed */
+	return araw_sample_format_from_adef(format) !=
+		       ARAW_SAMPLE_FORMAT_UNKNOWN &&
+	       format->pcm.signed_val == (format->bit_depth > 8);
+}
+
+
+void araw_latency_stats_add(struct araw_latency_stats *stats, uint64_t ns)
+{
+	unsigned int bucket = 0;
+
+	if (stats->count == 0 || ns < stats->min)
+		stats->min = ns;
+	if (ns > stats->max)
+		stats->max = ns;
+	stats->count++;
+	stats->total += ns;
+
+	if (ns > 0)
+		bucket = 63 - __builtin_clzll(ns);
+	if (bucket >= ARAW_LATENCY_BUCKET_COUNT)
+		bucket = ARAW_LATENCY_BUCKET_COUNT - 1;
+	stats->buckets[bucket]++;
+}
+
+
+void araw_stats_read(const unsigned int *seq, void *dst, size_t size)
+{
+	unsigned int start;
+
+	do {
+		start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (start & 1)
+			continue;
+		memcpy(dst, seq, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start);
+}
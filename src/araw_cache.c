@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "araw_priv.h"
+
+
+struct cache_entry {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct araw_header_info info;
+	/* Last use, 0 if the entry is free */
+	uint64_t stamp;
+};
+
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_entry cache[ARAW_HEADER_CACHE_SIZE];
+static uint64_t cache_stamp;
+
+
+static void entry_clear(struct cache_entry *entry)
+{
+	free(entry->path);
+	free(entry->info.chunks);
+	memset(entry, 0, sizeof(*entry));
+}
+
+
+static bool entry_is_file(const struct cache_entry *entry,
+			  const char *path,
+			  const struct stat *st)
+{
+	return entry->stamp != 0 && entry->dev == st->st_dev &&
+	       entry->ino == st->st_ino && strcmp(entry->path, path) == 0;
+}
+
+
+static bool entry_is_valid(const struct cache_entry *entry,
+			   const struct stat *st)
+{
+	return entry->size == st->st_size &&
+	       entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+	       entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+
+int araw_header_cache_get(const char *path,
+			  const struct stat *st,
+			  struct araw_header_info *info)
+{
+	int ret = -ENOENT;
+	unsigned int i;
+	struct cache_entry *entry;
+	struct araw_chunk *chunks;
+
+	pthread_mutex_lock(&cache_mutex);
+	for (i = 0; i < ARAW_HEADER_CACHE_SIZE; i++) {
+		entry = &cache[i];
+		if (!entry_is_file(entry, path, st))
+			continue;
+		if (!entry_is_valid(entry, st)) {
+			/* The file has changed */
+			entry_clear(entry);
+			break;
+		}
+		chunks = malloc(entry->info.chunk_count * sizeof(*chunks));
+		if (chunks == NULL) {
+			ret = -ENOMEM;
+			break;
+		}
+		memcpy(chunks,
+		       entry->info.chunks,
+		       entry->info.chunk_count * sizeof(*chunks));
+		*info = entry->info;
+		info->chunks = chunks;
+		entry->stamp = ++cache_stamp;
+		ret = 0;
+		break;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	return ret;
+}
+
+
+void araw_header_cache_put(const char *path,
+			   const struct stat *st,
+			   const struct araw_header_info *info)
+{
+	unsigned int i;
+	struct cache_entry *entry = NULL, tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.path = strdup(path);
+	tmp.info = *info;
+	tmp.info.chunks = malloc(info->chunk_count * sizeof(*info->chunks));
+	if (tmp.path == NULL || tmp.info.chunks == NULL) {
+		/* Not cached */
+		entry_clear(&tmp);
+		return;
+	}
+	memcpy(tmp.info.chunks,
+	       info->chunks,
+	       info->chunk_count * sizeof(*info->chunks));
+	tmp.dev = st->st_dev;
+	tmp.ino = st->st_ino;
+	tmp.size = st->st_size;
+	tmp.mtime = st->st_mtim;
+
+	pthread_mutex_lock(&cache_mutex);
+	for (i = 0; i < ARAW_HEADER_CACHE_SIZE; i++) {
+		if (entry_is_file(&cache[i], path, st)) {
+			entry = &cache[i];
+			break;
+		}
+		/* Otherwise the first free, or least recently used, entry */
+		if (entry == NULL || cache[i].stamp < entry->stamp)
+			entry = &cache[i];
+	}
+	entry_clear(entry);
+	*entry = tmp;
+	entry->stamp = ++cache_stamp;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+
+void araw_reader_cache_clear(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&cache_mutex);
+	for (i = 0; i < ARAW_HEADER_CACHE_SIZE; i++)
+		entry_clear(&cache[i]);
+	pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,1986 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define ARAW_CONVERT_X86
+#	include <immintrin.h>
+#elif defined(__aarch64__)
+#	define ARAW_CONVERT_NEON
+#	include <arm_neon.h>
+#endif
+
+/* Instruction set extensions */
+#define ISA_SSE2 (1 << 0)
+#define ISA_AVX2 (1 << 1)
+#define ISA_NEON (1 << 2)
+
+/* Full scale of a left-justified 32-bit sample */
+#define F32_SCALE 2147483648.f
+
+
+static unsigned int isa_flags;
+static pthread_once_t isa_flags_is_init = PTHREAD_ONCE_INIT;
+static void initialize_isa_flags(void)
+{
+#ifdef ARAW_CONVERT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		isa_flags |= ISA_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		isa_flags |= ISA_AVX2;
+#endif
+#ifdef ARAW_CONVERT_NEON
+	/* NEON is mandatory on AArch64 */
+	isa_flags |= ISA_NEON;
+#endif
+}
+
+
+size_t araw_sample_format_size(enum araw_sample_format format)
+{
+	switch (format) {
+	case ARAW_SAMPLE_FORMAT_U8:
+	case ARAW_SAMPLE_FORMAT_S8:
+		return 1;
+	case ARAW_SAMPLE_FORMAT_S16:
+		return 2;
+	case ARAW_SAMPLE_FORMAT_S24:
+		return 3;
+	case ARAW_SAMPLE_FORMAT_S32:
+	case ARAW_SAMPLE_FORMAT_F32:
+		return 4;
+	case ARAW_SAMPLE_FORMAT_F64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+
+enum araw_sample_format
+araw_sample_format_from_adef(const struct adef_format *format)
+{
+	if (format->encoding != ADEF_ENCODING_PCM)
+		return ARAW_SAMPLE_FORMAT_UNKNOWN;
+
+	switch (format->bit_depth) {
+	case 8:
+		return format->pcm.signed_val ? ARAW_SAMPLE_FORMAT_S8
+					      : ARAW_SAMPLE_FORMAT_U8;
+	case 16:
+		return ARAW_SAMPLE_FORMAT_S16;
+	case 24:
+		return ARAW_SAMPLE_FORMAT_S24;
+	case 32:
+		return ARAW_SAMPLE_FORMAT_S32;
+	default:
+		return ARAW_SAMPLE_FORMAT_UNKNOWN;
+	}
+}
+
+
+void araw_sample_format_to_adef(enum araw_sample_format sample_format,
+				struct adef_format *format)
+{
+	format->encoding = ADEF_ENCODING_PCM;
+	format->bit_depth = 8 * araw_sample_format_size(sample_format);
+	format->pcm.signed_val = (sample_format != ARAW_SAMPLE_FORMAT_U8);
+	format->pcm.little_endian = ARAW_HOST_LE;
+}
+
+
+/*
+ * Generic (scalar) conversion: integer samples go through a left-justified
+ * signed 32-bit intermediate, floating point samples through a double and
+ * are scaled so that full scale integer is [-1.0, 1.0[
+ */
+
+static inline int32_t
+sample_load_i32(const uint8_t *p, enum araw_sample_format format, bool le)
+{
+	uint32_t v;
+
+	switch (format) {
+	case ARAW_SAMPLE_FORMAT_U8:
+		return (int32_t)((uint32_t)(p[0] ^ 0x80) << 24);
+	case ARAW_SAMPLE_FORMAT_S8:
+		return (int32_t)((uint32_t)p[0] << 24);
+	case ARAW_SAMPLE_FORMAT_S16:
+		v = le ? (p[0] | p[1] << 8) : (p[1] | p[0] << 8);
+		return (int32_t)(v << 16);
+	case ARAW_SAMPLE_FORMAT_S24:
+		v = le ? (p[0] | p[1] << 8 | (uint32_t)p[2] << 16)
+		       : (p[2] | p[1] << 8 | (uint32_t)p[0] << 16);
+		return (int32_t)(v << 8);
+	case ARAW_SAMPLE_FORMAT_S32:
+		v = le ? (p[0] | p[1] << 8 | (uint32_t)p[2] << 16 |
+			  (uint32_t)p[3] << 24)
+		       : (p[3] | p[2] << 8 | (uint32_t)p[1] << 16 |
+			  (uint32_t)p[0] << 24);
+		return (int32_t)v;
+	default:
+		return 0;
+	}
+}
+
+
+static inline void sample_store_i32(uint8_t *p,
+				    enum araw_sample_format format,
+				    bool le,
+				    int32_t val)
+{
+	uint32_t v = (uint32_t)val;
+	size_t i, size = araw_sample_format_size(format);
+
+	if (format == ARAW_SAMPLE_FORMAT_U8)
+		v ^= 0x80000000;
+
+	/* Keep the most significant bytes */
+	for (i = 0; i < size; i++) {
+		uint8_t b = (v >> (24 - 8 * i)) & 0xff;
+		if (le)
+			p[size - 1 - i] = b;
+		else
+			p[i] = b;
+	}
+}
+
+
+static inline double
+sample_load_float(const uint8_t *p, enum araw_sample_format format, bool le)
+{
+	uint32_t v32;
+	uint64_t v64;
+	float f;
+	double d;
+
+	if (format == ARAW_SAMPLE_FORMAT_F32) {
+		memcpy(&v32, p, sizeof(v32));
+		if (le != ARAW_HOST_LE)
+			v32 = __builtin_bswap32(v32);
+		memcpy(&f, &v32, sizeof(f));
+		return f;
+	}
+
+	memcpy(&v64, p, sizeof(v64));
+	if (le != ARAW_HOST_LE)
+		v64 = __builtin_bswap64(v64);
+	memcpy(&d, &v64, sizeof(d));
+	return d;
+}
+
+
+static inline void sample_store_float(uint8_t *p,
+				      enum araw_sample_format format,
+				      bool le,
+				      double d)
+{
+	uint32_t v32;
+	uint64_t v64;
+	float f;
+
+	if (format == ARAW_SAMPLE_FORMAT_F32) {
+		f = (float)d;
+		memcpy(&v32, &f, sizeof(v32));
+		if (le != ARAW_HOST_LE)
+			v32 = __builtin_bswap32(v32);
+		memcpy(p, &v32, sizeof(v32));
+		return;
+	}
+
+	memcpy(&v64, &d, sizeof(v64));
+	if (le != ARAW_HOST_LE)
+		v64 = __builtin_bswap64(v64);
+	memcpy(p, &v64, sizeof(v64));
+}
+
+
+static inline bool sample_format_is_float(enum araw_sample_format format)
+{
+	return format == ARAW_SAMPLE_FORMAT_F32 ||
+	       format == ARAW_SAMPLE_FORMAT_F64;
+}
+
+
+/* Quantize a floating point sample to a left-justified integer of the
+ * given size, rounding to nearest and saturating */
+static inline int32_t float_to_i32(double d, size_t size)
+{
+	int64_t max = ((int64_t)1 << (8 * size - 1)) - 1;
+	int64_t v;
+
+	d *= (double)(max + 1);
+	if (d >= (double)max)
+		v = max;
+	else if (d <= (double)(-max - 1))
+		v = -max - 1;
+	else
+		v = llrint(d);
+	return (int32_t)((uint32_t)v << (32 - 8 * size));
+}
+
+
+static void convert_generic(const struct araw_convert *conv,
+			    uint8_t *dst,
+			    const uint8_t *src,
+			    size_t count)
+{
+	size_t i;
+	size_t src_size = conv->src_size;
+	size_t dst_size = conv->dst_size;
+	bool src_float = sample_format_is_float(conv->src_format);
+	bool dst_float = sample_format_is_float(conv->dst_format);
+	double d;
+
+	for (i = 0; i < count; i++, src += src_size, dst += dst_size) {
+		if (src_float && dst_float) {
+			d = sample_load_float(
+				src, conv->src_format, conv->src_le);
+			sample_store_float(
+				dst, conv->dst_format, conv->dst_le, d);
+		} else if (src_float) {
+			d = sample_load_float(
+				src, conv->src_format, conv->src_le);
+			sample_store_i32(dst,
+					 conv->dst_format,
+					 conv->dst_le,
+					 float_to_i32(d, dst_size));
+		} else if (dst_float) {
+			d = (double)sample_load_i32(
+				    src, conv->src_format, conv->src_le) /
+			    F32_SCALE;
+			sample_store_float(
+				dst, conv->dst_format, conv->dst_le, d);
+		} else {
+			sample_store_i32(dst,
+					 conv->dst_format,
+					 conv->dst_le,
+					 sample_load_i32(src,
+							 conv->src_format,
+							 conv->src_le));
+		}
+	}
+}
+
+
+/*
+ * Specialized scalar kernels (native endianness); these are also used for
+ * the tail of the SIMD kernels
+ */
+
+static void s16_to_f32_c(const struct araw_convert *conv,
+			 uint8_t *dst,
+			 const uint8_t *src,
+			 size_t count)
+{
+	const int16_t *s = (const int16_t *)src;
+	float *d = (float *)dst;
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++)
+		d[i] = (float)s[i] * (1.f / 32768.f);
+}
+
+
+static void f32_to_s16_c(const struct araw_convert *conv,
+			 uint8_t *dst,
+			 const uint8_t *src,
+			 size_t count)
+{
+	const float *s = (const float *)src;
+	int16_t *d = (int16_t *)dst;
+	size_t i;
+	float f;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++) {
+		/* Clamp before rounding, out of range conversions are
+		 * undefined; NaN gives 0 */
+		f = s[i] * 32768.f;
+		if (isnan(f))
+			d[i] = 0;
+		else if (f >= INT16_MAX)
+			d[i] = INT16_MAX;
+		else if (f <= INT16_MIN)
+			d[i] = INT16_MIN;
+		else
+			d[i] = lrintf(f);
+	}
+}
+
+
+static void s32_to_f32_c(const struct araw_convert *conv,
+			 uint8_t *dst,
+			 const uint8_t *src,
+			 size_t count)
+{
+	const int32_t *s = (const int32_t *)src;
+	float *d = (float *)dst;
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++)
+		d[i] = (float)s[i] * (1.f / F32_SCALE);
+}
+
+
+static void f32_to_s32_c(const struct araw_convert *conv,
+			 uint8_t *dst,
+			 const uint8_t *src,
+			 size_t count)
+{
+	const float *s = (const float *)src;
+	int32_t *d = (int32_t *)dst;
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++)
+		d[i] = float_to_i32(s[i], 4);
+}
+
+
+static void u8_s8_c(const struct araw_convert *conv,
+		    uint8_t *dst,
+		    const uint8_t *src,
+		    size_t count)
+{
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++)
+		dst[i] = src[i] ^ 0x80;
+}
+
+
+static void swap16_c(const struct araw_convert *conv,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t count)
+{
+	uint16_t v;
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&v, src + 2 * i, sizeof(v));
+		v = __builtin_bswap16(v);
+		memcpy(dst + 2 * i, &v, sizeof(v));
+	}
+}
+
+
+static void swap24_c(const struct araw_convert *conv,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t count)
+{
+	size_t i;
+	uint8_t b;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++, src += 3, dst += 3) {
+		b = src[0];
+		dst[1] = src[1];
+		dst[0] = src[2];
+		dst[2] = b;
+	}
+}
+
+
+static void swap32_c(const struct araw_convert *conv,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t count)
+{
+	uint32_t v;
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&v, src + 4 * i, sizeof(v));
+		v = __builtin_bswap32(v);
+		memcpy(dst + 4 * i, &v, sizeof(v));
+	}
+}
+
+
+static void swap64_c(const struct araw_convert *conv,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t count)
+{
+	uint64_t v;
+	size_t i;
+
+	(void)conv;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&v, src + 8 * i, sizeof(v));
+		v = __builtin_bswap64(v);
+		memcpy(dst + 8 * i, &v, sizeof(v));
+	}
+}
+
+
+#ifdef ARAW_CONVERT_X86
+
+/*
+ * SSE2 kernels
+ */
+
+__attribute__((target("sse2"))) static void
+s16_to_f32_sse2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m128 scale = _mm_set1_ps(1.f / 32768.f);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps((float *)(dst + 4 * i),
+			      _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps((float *)(dst + 4 * i + 16),
+			      _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	s16_to_f32_c(conv, dst + 4 * i, src + 2 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+f32_to_s16_sse2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m128 scale = _mm_set1_ps(32768.f);
+	const __m128 min = _mm_set1_ps(INT16_MIN);
+	const __m128 max = _mm_set1_ps(INT16_MAX);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128 lo = _mm_mul_ps(
+			_mm_loadu_ps((const float *)(src + 4 * i)), scale);
+		__m128 hi = _mm_mul_ps(
+			_mm_loadu_ps((const float *)(src + 4 * i + 16)), scale);
+		/* Clamp first: out of range conversions give INT32_MIN,
+		 * which would saturate positive overflows to INT16_MIN;
+		 * NaN gives 0 as in the scalar kernel */
+		lo = _mm_and_ps(lo, _mm_cmpord_ps(lo, lo));
+		hi = _mm_and_ps(hi, _mm_cmpord_ps(hi, hi));
+		lo = _mm_max_ps(_mm_min_ps(lo, max), min);
+		hi = _mm_max_ps(_mm_min_ps(hi, max), min);
+		__m128i v = _mm_packs_epi32(_mm_cvtps_epi32(lo),
+					    _mm_cvtps_epi32(hi));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), v);
+	}
+	f32_to_s16_c(conv, dst + 2 * i, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+s32_to_f32_sse2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m128 scale = _mm_set1_ps(1.f / F32_SCALE);
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+		_mm_storeu_ps((float *)(dst + 4 * i),
+			      _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+	s32_to_f32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+f32_to_s32_sse2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m128 scale = _mm_set1_ps(F32_SCALE);
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 f = _mm_mul_ps(_mm_loadu_ps((const float *)(src + 4 * i)),
+				      scale);
+		/* Positive overflows convert to INT32_MIN: flip them to
+		 * INT32_MAX */
+		__m128i v = _mm_xor_si128(
+			_mm_cvtps_epi32(f),
+			_mm_castps_si128(_mm_cmpge_ps(f, scale)));
+		_mm_storeu_si128((__m128i *)(dst + 4 * i), v);
+	}
+	f32_to_s32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void swap16_sse2(
+	const struct araw_convert *conv,
+	uint8_t *dst,
+	const uint8_t *src,
+	size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), v);
+	}
+	swap16_c(conv, dst + 2 * i, src + 2 * i, count - i);
+}
+
+
+/*
+ * AVX2 kernels
+ */
+
+__attribute__((target("avx2"))) static void
+s16_to_f32_avx2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.f / 32768.f);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(
+			_mm_loadu_si128((const __m128i *)(src + 2 * i)));
+		_mm256_storeu_ps((float *)(dst + 4 * i),
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	s16_to_f32_c(conv, dst + 4 * i, src + 2 * i, count - i);
+}
+
+
+__attribute__((target("avx2"))) static void
+f32_to_s16_avx2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(32768.f);
+	const __m256 min = _mm256_set1_ps(INT16_MIN);
+	const __m256 max = _mm256_set1_ps(INT16_MAX);
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m256 lo = _mm256_mul_ps(
+			_mm256_loadu_ps((const float *)(src + 4 * i)), scale);
+		__m256 hi = _mm256_mul_ps(
+			_mm256_loadu_ps((const float *)(src + 4 * i + 32)),
+			scale);
+		lo = _mm256_and_ps(lo, _mm256_cmp_ps(lo, lo, _CMP_ORD_Q));
+		hi = _mm256_and_ps(hi, _mm256_cmp_ps(hi, hi, _CMP_ORD_Q));
+		lo = _mm256_max_ps(_mm256_min_ps(lo, max), min);
+		hi = _mm256_max_ps(_mm256_min_ps(hi, max), min);
+		__m256i v = _mm256_packs_epi32(_mm256_cvtps_epi32(lo),
+					       _mm256_cvtps_epi32(hi));
+		/* Packing works per 128-bit lane: restore the order */
+		v = _mm256_permute4x64_epi64(v, 0xd8);
+		_mm256_storeu_si256((__m256i *)(dst + 2 * i), v);
+	}
+	f32_to_s16_c(conv, dst + 2 * i, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("avx2"))) static void
+s32_to_f32_avx2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(1.f / F32_SCALE);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i v =
+			_mm256_loadu_si256((const __m256i *)(src + 4 * i));
+		_mm256_storeu_ps((float *)(dst + 4 * i),
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	s32_to_f32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("avx2"))) static void
+f32_to_s32_avx2(const struct araw_convert *conv,
+		uint8_t *dst,
+		const uint8_t *src,
+		size_t count)
+{
+	const __m256 scale = _mm256_set1_ps(F32_SCALE);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256 f = _mm256_mul_ps(
+			_mm256_loadu_ps((const float *)(src + 4 * i)), scale);
+		__m256i v = _mm256_xor_si256(
+			_mm256_cvtps_epi32(f),
+			_mm256_castps_si256(_mm256_cmp_ps(f, scale, _CMP_GE_OQ)));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i), v);
+	}
+	f32_to_s32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("avx2"))) static void swap16_avx2(
+	const struct araw_convert *conv,
+	uint8_t *dst,
+	const uint8_t *src,
+	size_t count)
+{
+	const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+					      9, 8, 11, 10, 13, 12, 15, 14,
+					      1, 0, 3, 2, 5, 4, 7, 6,
+					      9, 8, 11, 10, 13, 12, 15, 14);
+	size_t i;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		__m256i v =
+			_mm256_loadu_si256((const __m256i *)(src + 2 * i));
+		_mm256_storeu_si256((__m256i *)(dst + 2 * i),
+				    _mm256_shuffle_epi8(v, mask));
+	}
+	swap16_c(conv, dst + 2 * i, src + 2 * i, count - i);
+}
+
+
+__attribute__((target("avx2"))) static void swap32_avx2(
+	const struct araw_convert *conv,
+	uint8_t *dst,
+	const uint8_t *src,
+	size_t count)
+{
+	const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					      11, 10, 9, 8, 15, 14, 13, 12,
+					      3, 2, 1, 0, 7, 6, 5, 4,
+					      11, 10, 9, 8, 15, 14, 13, 12);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i v =
+			_mm256_loadu_si256((const __m256i *)(src + 4 * i));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * i),
+				    _mm256_shuffle_epi8(v, mask));
+	}
+	swap32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+#endif /* ARAW_CONVERT_X86 */
+
+
+#ifdef ARAW_CONVERT_NEON
+
+/*
+ * NEON kernels
+ */
+
+static void s16_to_f32_neon(const struct araw_convert *conv,
+			    uint8_t *dst,
+			    const uint8_t *src,
+			    size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		int16x8_t v = vld1q_s16((const int16_t *)(src + 2 * i));
+		float32x4_t lo = vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(v)), 15);
+		float32x4_t hi =
+			vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(v)), 15);
+		vst1q_f32((float *)(dst + 4 * i), lo);
+		vst1q_f32((float *)(dst + 4 * i + 16), hi);
+	}
+	s16_to_f32_c(conv, dst + 4 * i, src + 2 * i, count - i);
+}
+
+
+static void f32_to_s16_neon(const struct araw_convert *conv,
+			    uint8_t *dst,
+			    const uint8_t *src,
+			    size_t count)
+{
+	const float32x4_t scale = vdupq_n_f32(32768.f);
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		float32x4_t lo = vld1q_f32((const float *)(src + 4 * i));
+		float32x4_t hi = vld1q_f32((const float *)(src + 4 * i + 16));
+		/* Round to nearest, then saturate when narrowing */
+		int16x8_t v = vcombine_s16(
+			vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(lo, scale))),
+			vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(hi, scale))));
+		vst1q_s16((int16_t *)(dst + 2 * i), v);
+	}
+	f32_to_s16_c(conv, dst + 2 * i, src + 4 * i, count - i);
+}
+
+
+static void s32_to_f32_neon(const struct araw_convert *conv,
+			    uint8_t *dst,
+			    const uint8_t *src,
+			    size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		int32x4_t v = vld1q_s32((const int32_t *)(src + 4 * i));
+		vst1q_f32((float *)(dst + 4 * i), vcvtq_n_f32_s32(v, 31));
+	}
+	s32_to_f32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+
+static void f32_to_s32_neon(const struct araw_convert *conv,
+			    uint8_t *dst,
+			    const uint8_t *src,
+			    size_t count)
+{
+	const float32x4_t scale = vdupq_n_f32(F32_SCALE);
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		float32x4_t f = vld1q_f32((const float *)(src + 4 * i));
+		/* The conversion saturates */
+		vst1q_s32((int32_t *)(dst + 4 * i),
+			  vcvtnq_s32_f32(vmulq_f32(f, scale)));
+	}
+	f32_to_s32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+
+static void swap16_neon(const struct araw_convert *conv,
+			uint8_t *dst,
+			const uint8_t *src,
+			size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+		vst1q_u8(dst + 2 * i, vrev16q_u8(vld1q_u8(src + 2 * i)));
+	swap16_c(conv, dst + 2 * i, src + 2 * i, count - i);
+}
+
+
+static void swap32_neon(const struct araw_convert *conv,
+			uint8_t *dst,
+			const uint8_t *src,
+			size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4)
+		vst1q_u8(dst + 4 * i, vrev32q_u8(vld1q_u8(src + 4 * i)));
+	swap32_c(conv, dst + 4 * i, src + 4 * i, count - i);
+}
+
+#endif /* ARAW_CONVERT_NEON */
+
+
+/* Kernels for native endianness conversions, best first; swap kernels are
+ * used for endianness conversions within the same sample format */
+struct convert_kernel {
+	enum araw_sample_format src;
+	enum araw_sample_format dst;
+	bool swap;
+	unsigned int isa;
+	araw_convert_fn_t fn;
+};
+
+
+static const struct convert_kernel kernels[] = {
+#ifdef ARAW_CONVERT_X86
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_F32, false, ISA_AVX2,
+	 s16_to_f32_avx2},
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_F32, false, ISA_SSE2,
+	 s16_to_f32_sse2},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S16, false, ISA_AVX2,
+	 f32_to_s16_avx2},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S16, false, ISA_SSE2,
+	 f32_to_s16_sse2},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_F32, false, ISA_AVX2,
+	 s32_to_f32_avx2},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_F32, false, ISA_SSE2,
+	 s32_to_f32_sse2},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S32, false, ISA_AVX2,
+	 f32_to_s32_avx2},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S32, false, ISA_SSE2,
+	 f32_to_s32_sse2},
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_S16, true, ISA_AVX2,
+	 swap16_avx2},
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_S16, true, ISA_SSE2,
+	 swap16_sse2},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_S32, true, ISA_AVX2,
+	 swap32_avx2},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_F32, true, ISA_AVX2,
+	 swap32_avx2},
+#endif /* ARAW_CONVERT_X86 */
+#ifdef ARAW_CONVERT_NEON
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_F32, false, ISA_NEON,
+	 s16_to_f32_neon},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S16, false, ISA_NEON,
+	 f32_to_s16_neon},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_F32, false, ISA_NEON,
+	 s32_to_f32_neon},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S32, false, ISA_NEON,
+	 f32_to_s32_neon},
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_S16, true, ISA_NEON,
+	 swap16_neon},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_S32, true, ISA_NEON,
+	 swap32_neon},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_F32, true, ISA_NEON,
+	 swap32_neon},
+#endif /* ARAW_CONVERT_NEON */
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_F32, false, 0, s16_to_f32_c},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S16, false, 0, f32_to_s16_c},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_F32, false, 0, s32_to_f32_c},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_S32, false, 0, f32_to_s32_c},
+	{ARAW_SAMPLE_FORMAT_U8, ARAW_SAMPLE_FORMAT_S8, false, 0, u8_s8_c},
+	{ARAW_SAMPLE_FORMAT_S8, ARAW_SAMPLE_FORMAT_U8, false, 0, u8_s8_c},
+	{ARAW_SAMPLE_FORMAT_S16, ARAW_SAMPLE_FORMAT_S16, true, 0, swap16_c},
+	{ARAW_SAMPLE_FORMAT_S24, ARAW_SAMPLE_FORMAT_S24, true, 0, swap24_c},
+	{ARAW_SAMPLE_FORMAT_S32, ARAW_SAMPLE_FORMAT_S32, true, 0, swap32_c},
+	{ARAW_SAMPLE_FORMAT_F32, ARAW_SAMPLE_FORMAT_F32, true, 0, swap32_c},
+	{ARAW_SAMPLE_FORMAT_F64, ARAW_SAMPLE_FORMAT_F64, true, 0, swap64_c},
+};
+
+
+int araw_convert_init(struct araw_convert *conv,
+		      enum araw_sample_format src_format,
+		      bool src_le,
+		      enum araw_sample_format dst_format,
+		      bool dst_le)
+{
+	size_t i;
+	bool swap;
+
+	ULOG_ERRNO_RETURN_ERR_IF(conv == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(araw_sample_format_size(src_format) == 0,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(araw_sample_format_size(dst_format) == 0,
+				 EINVAL);
+
+	(void)pthread_once(&isa_flags_is_init, initialize_isa_flags);
+
+	/* Endianness is meaningless for 8-bit samples */
+	if (araw_sample_format_size(src_format) == 1)
+		src_le = ARAW_HOST_LE;
+	if (araw_sample_format_size(dst_format) == 1)
+		dst_le = ARAW_HOST_LE;
+
+	memset(conv, 0, sizeof(*conv));
+	conv->src_format = src_format;
+	conv->src_le = src_le;
+	conv->dst_format = dst_format;
+	conv->dst_le = dst_le;
+	conv->src_size = araw_sample_format_size(src_format);
+	conv->dst_size = araw_sample_format_size(dst_format);
+
+	if (src_format == dst_format && src_le == dst_le) {
+		conv->identity = true;
+		return 0;
+	}
+
+	/* Look for a specialized kernel */
+	swap = (src_format == dst_format);
+	if (swap || (src_le == ARAW_HOST_LE && dst_le == ARAW_HOST_LE)) {
+		for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+			if (kernels[i].src != src_format ||
+			    kernels[i].dst != dst_format ||
+			    kernels[i].swap != swap ||
+			    (kernels[i].isa & isa_flags) != kernels[i].isa)
+				continue;
+			conv->fn = kernels[i].fn;
+			return 0;
+		}
+	}
+
+	conv->fn = convert_generic;
+	return 0;
+}
+
+
+/*
+ * Planar (non-interleaved) layout: generic kernels for any channel count
+ * and sample size, then kernels with a constant channel count and sample
+ * size that the compiler can unroll and vectorize
+ */
+
+static void deinterleave_generic(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 size_t stride,
+				 const uint8_t *src,
+				 size_t count)
+{
+	size_t i, size = planar->sample_size;
+	unsigned int c;
+
+	for (i = 0; i < count; i++) {
+		for (c = 0; c < planar->channel_count; c++) {
+			memcpy(dst + c * stride + i * size, src, size);
+			src += size;
+		}
+	}
+}
+
+
+static void interleave_generic(const struct araw_planar *planar,
+			       uint8_t *dst,
+			       const uint8_t *src,
+			       size_t stride,
+			       size_t count)
+{
+	size_t i, size = planar->sample_size;
+	unsigned int c;
+
+	for (i = 0; i < count; i++) {
+		for (c = 0; c < planar->channel_count; c++) {
+			memcpy(dst, src + c * stride + i * size, size);
+			dst += size;
+		}
+	}
+}
+
+
+#define PLANAR_KERNELS(_type, _bits, _channels)                                \
+	static void deinterleave_##_bits##_##_channels(                        \
+		const struct araw_planar *planar,                              \
+		uint8_t *dst,                                                  \
+		size_t stride,                                                 \
+		const uint8_t *src,                                            \
+		size_t count)                                                  \
+	{                                                                      \
+		const _type *s = (const _type *)src;                           \
+		size_t i;                                                      \
+		unsigned int c;                                                \
+		(void)planar;                                                  \
+		for (c = 0; c < _channels; c++) {                              \
+			_type *d = (_type *)(dst + c * stride);                \
+			for (i = 0; i < count; i++)                            \
+				d[i] = s[i * _channels + c];                   \
+		}                                                              \
+	}                                                                      \
+	static void interleave_##_bits##_##_channels(                          \
+		const struct araw_planar *planar,                              \
+		uint8_t *dst,                                                  \
+		const uint8_t *src,                                            \
+		size_t stride,                                                 \
+		size_t count)                                                  \
+	{                                                                      \
+		_type *d = (_type *)dst;                                       \
+		size_t i;                                                      \
+		unsigned int c;                                                \
+		(void)planar;                                                  \
+		for (c = 0; c < _channels; c++) {                              \
+			const _type *s = (const _type *)(src + c * stride);    \
+			for (i = 0; i < count; i++)                            \
+				d[i * _channels + c] = s[i];                   \
+		}                                                              \
+	}
+
+PLANAR_KERNELS(uint16_t, 16, 2)
+PLANAR_KERNELS(uint16_t, 16, 4)
+PLANAR_KERNELS(uint16_t, 16, 6)
+PLANAR_KERNELS(uint16_t, 16, 8)
+PLANAR_KERNELS(uint32_t, 32, 2)
+PLANAR_KERNELS(uint32_t, 32, 4)
+PLANAR_KERNELS(uint32_t, 32, 6)
+PLANAR_KERNELS(uint32_t, 32, 8)
+PLANAR_KERNELS(uint64_t, 64, 2)
+
+
+#ifdef ARAW_CONVERT_X86
+
+__attribute__((target("sse2"))) static void
+deinterleave_16_2_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+		__m128i b =
+			_mm_loadu_si128((const __m128i *)(src + 4 * i + 16));
+		/* Even samples: sign-extend the low halves; odd samples:
+		 * shift the high halves down, then pack back */
+		__m128i l = _mm_packs_epi32(
+			_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+			_mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+		__m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16),
+					    _mm_srai_epi32(b, 16));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), l);
+		_mm_storeu_si128((__m128i *)(dst + stride + 2 * i), r);
+	}
+	deinterleave_16_2(planar, dst + 2 * i, stride, src + 4 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_16_2_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m128i l = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+		__m128i r = _mm_loadu_si128(
+			(const __m128i *)(src + stride + 2 * i));
+		_mm_storeu_si128((__m128i *)(dst + 4 * i),
+				 _mm_unpacklo_epi16(l, r));
+		_mm_storeu_si128((__m128i *)(dst + 4 * i + 16),
+				 _mm_unpackhi_epi16(l, r));
+	}
+	interleave_16_2(planar, dst + 4 * i, src + 2 * i, stride, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_16_4_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+	unsigned int c;
+	__m128i v[4], t[4];
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		/* Two samples of 4 channels per vector */
+		for (c = 0; c < 4; c++)
+			v[c] = _mm_loadu_si128(
+				(const __m128i *)(src + 8 * i + 16 * c));
+		t[0] = _mm_unpacklo_epi16(v[0], v[1]);
+		t[1] = _mm_unpackhi_epi16(v[0], v[1]);
+		t[2] = _mm_unpacklo_epi16(v[2], v[3]);
+		t[3] = _mm_unpackhi_epi16(v[2], v[3]);
+		/* Channels 0/1 and 2/3 of samples 0-3, then 4-7 */
+		v[0] = _mm_unpacklo_epi16(t[0], t[1]);
+		v[1] = _mm_unpackhi_epi16(t[0], t[1]);
+		v[2] = _mm_unpacklo_epi16(t[2], t[3]);
+		v[3] = _mm_unpackhi_epi16(t[2], t[3]);
+		t[0] = _mm_unpacklo_epi64(v[0], v[2]);
+		t[1] = _mm_unpackhi_epi64(v[0], v[2]);
+		t[2] = _mm_unpacklo_epi64(v[1], v[3]);
+		t[3] = _mm_unpackhi_epi64(v[1], v[3]);
+		for (c = 0; c < 4; c++)
+			_mm_storeu_si128(
+				(__m128i *)(dst + c * stride + 2 * i), t[c]);
+	}
+	deinterleave_16_4(planar, dst + 2 * i, stride, src + 8 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_16_4_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+	unsigned int c;
+	__m128i v[4], t[4];
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 4; c++)
+			v[c] = _mm_loadu_si128(
+				(const __m128i *)(src + c * stride + 2 * i));
+		t[0] = _mm_unpacklo_epi16(v[0], v[1]);
+		t[1] = _mm_unpacklo_epi16(v[2], v[3]);
+		t[2] = _mm_unpackhi_epi16(v[0], v[1]);
+		t[3] = _mm_unpackhi_epi16(v[2], v[3]);
+		_mm_storeu_si128((__m128i *)(dst + 8 * i),
+				 _mm_unpacklo_epi32(t[0], t[1]));
+		_mm_storeu_si128((__m128i *)(dst + 8 * i + 16),
+				 _mm_unpackhi_epi32(t[0], t[1]));
+		_mm_storeu_si128((__m128i *)(dst + 8 * i + 32),
+				 _mm_unpacklo_epi32(t[2], t[3]));
+		_mm_storeu_si128((__m128i *)(dst + 8 * i + 48),
+				 _mm_unpackhi_epi32(t[2], t[3]));
+	}
+	interleave_16_4(planar, dst + 8 * i, src + 2 * i, stride, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_16_6_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint32_t tmp;
+	__m128i a[8], b[8];
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		/* Channels 0-3 and 4-5 of each sample in the low halves */
+		for (c = 0; c < 8; c++) {
+			a[c] = _mm_loadl_epi64(
+				(const __m128i *)(src + 12 * (i + c)));
+			memcpy(&tmp, src + 12 * (i + c) + 8, sizeof(tmp));
+			b[c] = _mm_cvtsi32_si128(tmp);
+		}
+		for (c = 0; c < 4; c++) {
+			a[c] = _mm_unpacklo_epi16(a[2 * c], a[2 * c + 1]);
+			b[c] = _mm_unpacklo_epi16(b[2 * c], b[2 * c + 1]);
+		}
+		a[4] = _mm_unpacklo_epi32(a[0], a[1]);
+		a[5] = _mm_unpackhi_epi32(a[0], a[1]);
+		a[6] = _mm_unpacklo_epi32(a[2], a[3]);
+		a[7] = _mm_unpackhi_epi32(a[2], a[3]);
+		b[4] = _mm_unpacklo_epi32(b[0], b[1]);
+		b[5] = _mm_unpacklo_epi32(b[2], b[3]);
+		_mm_storeu_si128((__m128i *)(dst + 2 * i),
+				 _mm_unpacklo_epi64(a[4], a[6]));
+		_mm_storeu_si128((__m128i *)(dst + stride + 2 * i),
+				 _mm_unpackhi_epi64(a[4], a[6]));
+		_mm_storeu_si128((__m128i *)(dst + 2 * stride + 2 * i),
+				 _mm_unpacklo_epi64(a[5], a[7]));
+		_mm_storeu_si128((__m128i *)(dst + 3 * stride + 2 * i),
+				 _mm_unpackhi_epi64(a[5], a[7]));
+		_mm_storeu_si128((__m128i *)(dst + 4 * stride + 2 * i),
+				 _mm_unpacklo_epi64(b[4], b[5]));
+		_mm_storeu_si128((__m128i *)(dst + 5 * stride + 2 * i),
+				 _mm_unpackhi_epi64(b[4], b[5]));
+	}
+	deinterleave_16_6(planar, dst + 2 * i, stride, src + 12 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_16_6_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint32_t tmp;
+	__m128i v[6], t[6];
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 6; c++)
+			v[c] = _mm_loadu_si128(
+				(const __m128i *)(src + c * stride + 2 * i));
+		for (c = 0; c < 3; c++) {
+			t[c] = _mm_unpacklo_epi16(v[2 * c], v[2 * c + 1]);
+			t[c + 3] = _mm_unpackhi_epi16(v[2 * c], v[2 * c + 1]);
+		}
+		/* Channels 0-3 of two samples per vector, channels 4-5 of
+		 * four samples per vector */
+		v[0] = _mm_unpacklo_epi32(t[0], t[1]);
+		v[1] = _mm_unpackhi_epi32(t[0], t[1]);
+		v[2] = _mm_unpacklo_epi32(t[3], t[4]);
+		v[3] = _mm_unpackhi_epi32(t[3], t[4]);
+		v[4] = t[2];
+		v[5] = t[5];
+		for (c = 0; c < 8; c++) {
+			_mm_storel_epi64((__m128i *)(dst + 12 * (i + c)),
+					 v[c / 2]);
+			v[c / 2] = _mm_srli_si128(v[c / 2], 8);
+			tmp = _mm_cvtsi128_si32(v[4 + c / 4]);
+			memcpy(dst + 12 * (i + c) + 8, &tmp, sizeof(tmp));
+			v[4 + c / 4] = _mm_srli_si128(v[4 + c / 4], 4);
+		}
+	}
+	interleave_16_6(planar, dst + 12 * i, src + 2 * i, stride, count - i);
+}
+
+
+/* 8x8 transpose of 16-bit values, used both ways */
+__attribute__((target("sse2"))) static inline void
+transpose_16_8_sse2(__m128i v[8], __m128i t[8])
+{
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		t[2 * c] = _mm_unpacklo_epi16(v[2 * c], v[2 * c + 1]);
+		t[2 * c + 1] = _mm_unpackhi_epi16(v[2 * c], v[2 * c + 1]);
+	}
+	for (c = 0; c < 2; c++) {
+		v[4 * c] = _mm_unpacklo_epi32(t[4 * c], t[4 * c + 2]);
+		v[4 * c + 1] = _mm_unpackhi_epi32(t[4 * c], t[4 * c + 2]);
+		v[4 * c + 2] = _mm_unpacklo_epi32(t[4 * c + 1], t[4 * c + 3]);
+		v[4 * c + 3] = _mm_unpackhi_epi32(t[4 * c + 1], t[4 * c + 3]);
+	}
+	for (c = 0; c < 4; c++) {
+		t[2 * c] = _mm_unpacklo_epi64(v[c], v[c + 4]);
+		t[2 * c + 1] = _mm_unpackhi_epi64(v[c], v[c + 4]);
+	}
+}
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_16_8_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+	unsigned int c;
+	__m128i v[8], t[8];
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 8; c++)
+			v[c] = _mm_loadu_si128(
+				(const __m128i *)(src + 16 * (i + c)));
+		transpose_16_8_sse2(v, t);
+		for (c = 0; c < 8; c++)
+			_mm_storeu_si128(
+				(__m128i *)(dst + c * stride + 2 * i), t[c]);
+	}
+	deinterleave_16_8(planar, dst + 2 * i, stride, src + 16 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_16_8_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+	unsigned int c;
+	__m128i v[8], t[8];
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 8; c++)
+			v[c] = _mm_loadu_si128(
+				(const __m128i *)(src + c * stride + 2 * i));
+		transpose_16_8_sse2(v, t);
+		for (c = 0; c < 8; c++)
+			_mm_storeu_si128((__m128i *)(dst + 16 * (i + c)),
+					 t[c]);
+	}
+	interleave_16_8(planar, dst + 16 * i, src + 2 * i, stride, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_32_2_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps((const float *)(src + 8 * i));
+		__m128 b = _mm_loadu_ps((const float *)(src + 8 * i + 16));
+		_mm_storeu_ps((float *)(dst + 4 * i),
+			      _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps((float *)(dst + stride + 4 * i),
+			      _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+	deinterleave_32_2(planar, dst + 4 * i, stride, src + 8 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_32_2_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 l = _mm_loadu_ps((const float *)(src + 4 * i));
+		__m128 r = _mm_loadu_ps((const float *)(src + stride + 4 * i));
+		_mm_storeu_ps((float *)(dst + 8 * i), _mm_unpacklo_ps(l, r));
+		_mm_storeu_ps((float *)(dst + 8 * i + 16),
+			      _mm_unpackhi_ps(l, r));
+	}
+	interleave_32_2(planar, dst + 8 * i, src + 4 * i, stride, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_32_4_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps((const float *)(src + 16 * i));
+		__m128 b = _mm_loadu_ps((const float *)(src + 16 * i + 16));
+		__m128 c = _mm_loadu_ps((const float *)(src + 16 * i + 32));
+		__m128 d = _mm_loadu_ps((const float *)(src + 16 * i + 48));
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		_mm_storeu_ps((float *)(dst + 4 * i), a);
+		_mm_storeu_ps((float *)(dst + stride + 4 * i), b);
+		_mm_storeu_ps((float *)(dst + 2 * stride + 4 * i), c);
+		_mm_storeu_ps((float *)(dst + 3 * stride + 4 * i), d);
+	}
+	deinterleave_32_4(planar, dst + 4 * i, stride, src + 16 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_32_4_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128 a = _mm_loadu_ps((const float *)(src + 4 * i));
+		__m128 b = _mm_loadu_ps((const float *)(src + stride + 4 * i));
+		__m128 c = _mm_loadu_ps(
+			(const float *)(src + 2 * stride + 4 * i));
+		__m128 d = _mm_loadu_ps(
+			(const float *)(src + 3 * stride + 4 * i));
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		_mm_storeu_ps((float *)(dst + 16 * i), a);
+		_mm_storeu_ps((float *)(dst + 16 * i + 16), b);
+		_mm_storeu_ps((float *)(dst + 16 * i + 32), c);
+		_mm_storeu_ps((float *)(dst + 16 * i + 48), d);
+	}
+	interleave_32_4(planar, dst + 16 * i, src + 4 * i, stride, count - i);
+}
+
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_32_6_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+	__m128 a, b, c, d, e, f, g, h;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		/* Channels 0-3, then channels 4-5 in the low halves */
+		a = _mm_loadu_ps((const float *)(src + 24 * i));
+		b = _mm_loadu_ps((const float *)(src + 24 * i + 24));
+		c = _mm_loadu_ps((const float *)(src + 24 * i + 48));
+		d = _mm_loadu_ps((const float *)(src + 24 * i + 72));
+		e = _mm_castsi128_ps(_mm_loadl_epi64(
+			(const __m128i *)(src + 24 * i + 16)));
+		f = _mm_castsi128_ps(_mm_loadl_epi64(
+			(const __m128i *)(src + 24 * i + 40)));
+		g = _mm_castsi128_ps(_mm_loadl_epi64(
+			(const __m128i *)(src + 24 * i + 64)));
+		h = _mm_castsi128_ps(_mm_loadl_epi64(
+			(const __m128i *)(src + 24 * i + 88)));
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		e = _mm_unpacklo_ps(e, f);
+		g = _mm_unpacklo_ps(g, h);
+		_mm_storeu_ps((float *)(dst + 4 * i), a);
+		_mm_storeu_ps((float *)(dst + stride + 4 * i), b);
+		_mm_storeu_ps((float *)(dst + 2 * stride + 4 * i), c);
+		_mm_storeu_ps((float *)(dst + 3 * stride + 4 * i), d);
+		_mm_storeu_ps((float *)(dst + 4 * stride + 4 * i),
+			      _mm_movelh_ps(e, g));
+		_mm_storeu_ps((float *)(dst + 5 * stride + 4 * i),
+			      _mm_movehl_ps(g, e));
+	}
+	deinterleave_32_6(planar, dst + 4 * i, stride, src + 24 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_32_6_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+	__m128 a, b, c, d, e, f, g;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		a = _mm_loadu_ps((const float *)(src + 4 * i));
+		b = _mm_loadu_ps((const float *)(src + stride + 4 * i));
+		c = _mm_loadu_ps((const float *)(src + 2 * stride + 4 * i));
+		d = _mm_loadu_ps((const float *)(src + 3 * stride + 4 * i));
+		e = _mm_loadu_ps((const float *)(src + 4 * stride + 4 * i));
+		f = _mm_loadu_ps((const float *)(src + 5 * stride + 4 * i));
+		_MM_TRANSPOSE4_PS(a, b, c, d);
+		/* Channels 4-5 of samples 0-1, then 2-3 */
+		g = _mm_unpacklo_ps(e, f);
+		e = _mm_unpackhi_ps(e, f);
+		_mm_storeu_ps((float *)(dst + 24 * i), a);
+		_mm_storel_pi((__m64 *)(dst + 24 * i + 16), g);
+		_mm_storeu_ps((float *)(dst + 24 * i + 24), b);
+		_mm_storeh_pi((__m64 *)(dst + 24 * i + 40), g);
+		_mm_storeu_ps((float *)(dst + 24 * i + 48), c);
+		_mm_storel_pi((__m64 *)(dst + 24 * i + 64), e);
+		_mm_storeu_ps((float *)(dst + 24 * i + 72), d);
+		_mm_storeh_pi((__m64 *)(dst + 24 * i + 88), e);
+	}
+	interleave_32_6(planar, dst + 24 * i, src + 4 * i, stride, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+deinterleave_32_8_sse2(const struct araw_planar *planar,
+		       uint8_t *dst,
+		       size_t stride,
+		       const uint8_t *src,
+		       size_t count)
+{
+	size_t i;
+	unsigned int c;
+	__m128 v[8];
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		/* Two 4x4 transposes: channels 0-3, then 4-7 */
+		for (c = 0; c < 8; c++)
+			v[c] = _mm_loadu_ps((const float *)(
+				src + 32 * i + 32 * (c % 4) + 16 * (c / 4)));
+		_MM_TRANSPOSE4_PS(v[0], v[1], v[2], v[3]);
+		_MM_TRANSPOSE4_PS(v[4], v[5], v[6], v[7]);
+		for (c = 0; c < 8; c++)
+			_mm_storeu_ps((float *)(dst + c * stride + 4 * i),
+				      v[c]);
+	}
+	deinterleave_32_8(planar, dst + 4 * i, stride, src + 32 * i, count - i);
+}
+
+
+__attribute__((target("sse2"))) static void
+interleave_32_8_sse2(const struct araw_planar *planar,
+		     uint8_t *dst,
+		     const uint8_t *src,
+		     size_t stride,
+		     size_t count)
+{
+	size_t i;
+	unsigned int c;
+	__m128 v[8];
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		for (c = 0; c < 8; c++)
+			v[c] = _mm_loadu_ps(
+				(const float *)(src + c * stride + 4 * i));
+		_MM_TRANSPOSE4_PS(v[0], v[1], v[2], v[3]);
+		_MM_TRANSPOSE4_PS(v[4], v[5], v[6], v[7]);
+		for (c = 0; c < 8; c++)
+			_mm_storeu_ps((float *)(dst + 32 * i + 32 * (c % 4) +
+						16 * (c / 4)),
+				      v[c]);
+	}
+	interleave_32_8(planar, dst + 32 * i, src + 4 * i, stride, count - i);
+}
+
+#endif /* ARAW_CONVERT_X86 */
+
+
+#ifdef ARAW_CONVERT_NEON
+
+static void deinterleave_16_2_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		uint16x8x2_t v = vld2q_u16((const uint16_t *)(src + 4 * i));
+		vst1q_u16((uint16_t *)(dst + 2 * i), v.val[0]);
+		vst1q_u16((uint16_t *)(dst + stride + 2 * i), v.val[1]);
+	}
+	deinterleave_16_2(planar, dst + 2 * i, stride, src + 4 * i, count - i);
+}
+
+
+static void interleave_16_2_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	uint16x8x2_t v;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		v.val[0] = vld1q_u16((const uint16_t *)(src + 2 * i));
+		v.val[1] = vld1q_u16((const uint16_t *)(src + stride + 2 * i));
+		vst2q_u16((uint16_t *)(dst + 4 * i), v);
+	}
+	interleave_16_2(planar, dst + 4 * i, src + 2 * i, stride, count - i);
+}
+
+
+static void deinterleave_16_4_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		uint16x8x4_t v = vld4q_u16((const uint16_t *)(src + 8 * i));
+		for (c = 0; c < 4; c++)
+			vst1q_u16((uint16_t *)(dst + c * stride + 2 * i),
+				  v.val[c]);
+	}
+	deinterleave_16_4(planar, dst + 2 * i, stride, src + 8 * i, count - i);
+}
+
+
+static void interleave_16_4_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint16x8x4_t v;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 4; c++)
+			v.val[c] = vld1q_u16(
+				(const uint16_t *)(src + c * stride + 2 * i));
+		vst4q_u16((uint16_t *)(dst + 8 * i), v);
+	}
+	interleave_16_4(planar, dst + 8 * i, src + 2 * i, stride, count - i);
+}
+
+
+static void deinterleave_32_2_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		uint32x4x2_t v = vld2q_u32((const uint32_t *)(src + 8 * i));
+		vst1q_u32((uint32_t *)(dst + 4 * i), v.val[0]);
+		vst1q_u32((uint32_t *)(dst + stride + 4 * i), v.val[1]);
+	}
+	deinterleave_32_2(planar, dst + 4 * i, stride, src + 8 * i, count - i);
+}
+
+
+static void interleave_32_2_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	uint32x4x2_t v;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		v.val[0] = vld1q_u32((const uint32_t *)(src + 4 * i));
+		v.val[1] = vld1q_u32((const uint32_t *)(src + stride + 4 * i));
+		vst2q_u32((uint32_t *)(dst + 8 * i), v);
+	}
+	interleave_32_2(planar, dst + 8 * i, src + 4 * i, stride, count - i);
+}
+
+
+static void deinterleave_32_4_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		uint32x4x4_t v = vld4q_u32((const uint32_t *)(src + 16 * i));
+		for (c = 0; c < 4; c++)
+			vst1q_u32((uint32_t *)(dst + c * stride + 4 * i),
+				  v.val[c]);
+	}
+	deinterleave_32_4(planar, dst + 4 * i, stride, src + 16 * i, count - i);
+}
+
+
+static void interleave_32_4_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint32x4x4_t v;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		for (c = 0; c < 4; c++)
+			v.val[c] = vld1q_u32(
+				(const uint32_t *)(src + c * stride + 4 * i));
+		vst4q_u32((uint32_t *)(dst + 16 * i), v);
+	}
+	interleave_32_4(planar, dst + 16 * i, src + 4 * i, stride, count - i);
+}
+
+
+/*
+ * 6 and 8 channels: load 2 blocks of samples as 3 or 4 interleaved
+ * channel groups, then unzip each group
+ */
+
+static void deinterleave_16_6_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		uint16x8x3_t a = vld3q_u16((const uint16_t *)(src + 12 * i));
+		uint16x8x3_t b =
+			vld3q_u16((const uint16_t *)(src + 12 * i + 48));
+		for (c = 0; c < 3; c++) {
+			uint16x8x2_t v = vuzpq_u16(a.val[c], b.val[c]);
+			vst1q_u16((uint16_t *)(dst + c * stride + 2 * i),
+				  v.val[0]);
+			vst1q_u16((uint16_t *)(dst + (c + 3) * stride + 2 * i),
+				  v.val[1]);
+		}
+	}
+	deinterleave_16_6(planar, dst + 2 * i, stride, src + 12 * i, count - i);
+}
+
+
+static void interleave_16_6_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint16x8x3_t a, b;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 3; c++) {
+			uint16x8x2_t v = vzipq_u16(
+				vld1q_u16((const uint16_t *)(src + c * stride +
+							     2 * i)),
+				vld1q_u16((const uint16_t *)(src +
+							     (c + 3) * stride +
+							     2 * i)));
+			a.val[c] = v.val[0];
+			b.val[c] = v.val[1];
+		}
+		vst3q_u16((uint16_t *)(dst + 12 * i), a);
+		vst3q_u16((uint16_t *)(dst + 12 * i + 48), b);
+	}
+	interleave_16_6(planar, dst + 12 * i, src + 2 * i, stride, count - i);
+}
+
+
+static void deinterleave_16_8_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		uint16x8x4_t a = vld4q_u16((const uint16_t *)(src + 16 * i));
+		uint16x8x4_t b =
+			vld4q_u16((const uint16_t *)(src + 16 * i + 64));
+		for (c = 0; c < 4; c++) {
+			uint16x8x2_t v = vuzpq_u16(a.val[c], b.val[c]);
+			vst1q_u16((uint16_t *)(dst + c * stride + 2 * i),
+				  v.val[0]);
+			vst1q_u16((uint16_t *)(dst + (c + 4) * stride + 2 * i),
+				  v.val[1]);
+		}
+	}
+	deinterleave_16_8(planar, dst + 2 * i, stride, src + 16 * i, count - i);
+}
+
+
+static void interleave_16_8_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint16x8x4_t a, b;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		for (c = 0; c < 4; c++) {
+			uint16x8x2_t v = vzipq_u16(
+				vld1q_u16((const uint16_t *)(src + c * stride +
+							     2 * i)),
+				vld1q_u16((const uint16_t *)(src +
+							     (c + 4) * stride +
+							     2 * i)));
+			a.val[c] = v.val[0];
+			b.val[c] = v.val[1];
+		}
+		vst4q_u16((uint16_t *)(dst + 16 * i), a);
+		vst4q_u16((uint16_t *)(dst + 16 * i + 64), b);
+	}
+	interleave_16_8(planar, dst + 16 * i, src + 2 * i, stride, count - i);
+}
+
+
+static void deinterleave_32_6_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		uint32x4x3_t a = vld3q_u32((const uint32_t *)(src + 24 * i));
+		uint32x4x3_t b =
+			vld3q_u32((const uint32_t *)(src + 24 * i + 48));
+		for (c = 0; c < 3; c++) {
+			uint32x4x2_t v = vuzpq_u32(a.val[c], b.val[c]);
+			vst1q_u32((uint32_t *)(dst + c * stride + 4 * i),
+				  v.val[0]);
+			vst1q_u32((uint32_t *)(dst + (c + 3) * stride + 4 * i),
+				  v.val[1]);
+		}
+	}
+	deinterleave_32_6(planar, dst + 4 * i, stride, src + 24 * i, count - i);
+}
+
+
+static void interleave_32_6_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint32x4x3_t a, b;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		for (c = 0; c < 3; c++) {
+			uint32x4x2_t v = vzipq_u32(
+				vld1q_u32((const uint32_t *)(src + c * stride +
+							     4 * i)),
+				vld1q_u32((const uint32_t *)(src +
+							     (c + 3) * stride +
+							     4 * i)));
+			a.val[c] = v.val[0];
+			b.val[c] = v.val[1];
+		}
+		vst3q_u32((uint32_t *)(dst + 24 * i), a);
+		vst3q_u32((uint32_t *)(dst + 24 * i + 48), b);
+	}
+	interleave_32_6(planar, dst + 24 * i, src + 4 * i, stride, count - i);
+}
+
+
+static void deinterleave_32_8_neon(const struct araw_planar *planar,
+				   uint8_t *dst,
+				   size_t stride,
+				   const uint8_t *src,
+				   size_t count)
+{
+	size_t i;
+	unsigned int c;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		uint32x4x4_t a = vld4q_u32((const uint32_t *)(src + 32 * i));
+		uint32x4x4_t b =
+			vld4q_u32((const uint32_t *)(src + 32 * i + 64));
+		for (c = 0; c < 4; c++) {
+			uint32x4x2_t v = vuzpq_u32(a.val[c], b.val[c]);
+			vst1q_u32((uint32_t *)(dst + c * stride + 4 * i),
+				  v.val[0]);
+			vst1q_u32((uint32_t *)(dst + (c + 4) * stride + 4 * i),
+				  v.val[1]);
+		}
+	}
+	deinterleave_32_8(planar, dst + 4 * i, stride, src + 32 * i, count - i);
+}
+
+
+static void interleave_32_8_neon(const struct araw_planar *planar,
+				 uint8_t *dst,
+				 const uint8_t *src,
+				 size_t stride,
+				 size_t count)
+{
+	size_t i;
+	unsigned int c;
+	uint32x4x4_t a, b;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		for (c = 0; c < 4; c++) {
+			uint32x4x2_t v = vzipq_u32(
+				vld1q_u32((const uint32_t *)(src + c * stride +
+							     4 * i)),
+				vld1q_u32((const uint32_t *)(src +
+							     (c + 4) * stride +
+							     4 * i)));
+			a.val[c] = v.val[0];
+			b.val[c] = v.val[1];
+		}
+		vst4q_u32((uint32_t *)(dst + 32 * i), a);
+		vst4q_u32((uint32_t *)(dst + 32 * i + 64), b);
+	}
+	interleave_32_8(planar, dst + 32 * i, src + 4 * i, stride, count - i);
+}
+
+#endif /* ARAW_CONVERT_NEON */
+
+
+/* Planar kernels, best first */
+struct planar_kernel {
+	size_t sample_size;
+	unsigned int channel_count;
+	unsigned int isa;
+	araw_deinterleave_fn_t deinterleave;
+	araw_interleave_fn_t interleave;
+};
+
+
+static const struct planar_kernel planar_kernels[] = {
+#ifdef ARAW_CONVERT_X86
+	{2, 2, ISA_SSE2, deinterleave_16_2_sse2, interleave_16_2_sse2},
+	{2, 4, ISA_SSE2, deinterleave_16_4_sse2, interleave_16_4_sse2},
+	{2, 6, ISA_SSE2, deinterleave_16_6_sse2, interleave_16_6_sse2},
+	{2, 8, ISA_SSE2, deinterleave_16_8_sse2, interleave_16_8_sse2},
+	{4, 2, ISA_SSE2, deinterleave_32_2_sse2, interleave_32_2_sse2},
+	{4, 4, ISA_SSE2, deinterleave_32_4_sse2, interleave_32_4_sse2},
+	{4, 6, ISA_SSE2, deinterleave_32_6_sse2, interleave_32_6_sse2},
+	{4, 8, ISA_SSE2, deinterleave_32_8_sse2, interleave_32_8_sse2},
+#endif /* ARAW_CONVERT_X86 */
+#ifdef ARAW_CONVERT_NEON
+	{2, 2, ISA_NEON, deinterleave_16_2_neon, interleave_16_2_neon},
+	{2, 4, ISA_NEON, deinterleave_16_4_neon, interleave_16_4_neon},
+	{2, 6, ISA_NEON, deinterleave_16_6_neon, interleave_16_6_neon},
+	{2, 8, ISA_NEON, deinterleave_16_8_neon, interleave_16_8_neon},
+	{4, 2, ISA_NEON, deinterleave_32_2_neon, interleave_32_2_neon},
+	{4, 4, ISA_NEON, deinterleave_32_4_neon, interleave_32_4_neon},
+	{4, 6, ISA_NEON, deinterleave_32_6_neon, interleave_32_6_neon},
+	{4, 8, ISA_NEON, deinterleave_32_8_neon, interleave_32_8_neon},
+#endif /* ARAW_CONVERT_NEON */
+	{2, 2, 0, deinterleave_16_2, interleave_16_2},
+	{2, 4, 0, deinterleave_16_4, interleave_16_4},
+	{2, 6, 0, deinterleave_16_6, interleave_16_6},
+	{2, 8, 0, deinterleave_16_8, interleave_16_8},
+	{4, 2, 0, deinterleave_32_2, interleave_32_2},
+	{4, 4, 0, deinterleave_32_4, interleave_32_4},
+	{4, 6, 0, deinterleave_32_6, interleave_32_6},
+	{4, 8, 0, deinterleave_32_8, interleave_32_8},
+	{8, 2, 0, deinterleave_64_2, interleave_64_2},
+};
+
+
+int araw_planar_init(struct araw_planar *planar,
+		     unsigned int channel_count,
+		     size_t sample_size)
+{
+	size_t i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(planar == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(channel_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(sample_size == 0, EINVAL);
+
+	(void)pthread_once(&isa_flags_is_init, initialize_isa_flags);
+
+	planar->channel_count = channel_count;
+	planar->sample_size = sample_size;
+	planar->deinterleave = deinterleave_generic;
+	planar->interleave = interleave_generic;
+
+	for (i = 0; i < sizeof(planar_kernels) / sizeof(planar_kernels[0]);
+	     i++) {
+		if (planar_kernels[i].sample_size != sample_size ||
+		    planar_kernels[i].channel_count != channel_count ||
+		    (planar_kernels[i].isa & isa_flags) !=
+			    planar_kernels[i].isa)
+			continue;
+		planar->deinterleave = planar_kernels[i].deinterleave;
+		planar->interleave = planar_kernels[i].interleave;
+		break;
+	}
+
+	return 0;
+}
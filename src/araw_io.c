@@ -0,0 +1,452 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+
+/* stdio file backend */
+
+static ssize_t file_read(void *userdata, void *buf, size_t len)
+{
+	FILE *file = userdata;
+	size_t n;
+
+	n = fread(buf, 1, len, file);
+	if (n < len && ferror(file))
+		return -EIO;
+	return n;
+}
+
+
+static ssize_t file_write(void *userdata, const void *buf, size_t len)
+{
+	FILE *file = userdata;
+
+	if (fwrite(buf, len, 1, file) != 1)
+		return errno != 0 ? -errno : -EIO;
+	return len;
+}
+
+
+static int file_seek(void *userdata, int64_t offset, int whence)
+{
+	FILE *file = userdata;
+
+	if (fseeko(file, (off_t)offset, whence) < 0)
+		return -errno;
+	return 0;
+}
+
+
+static int64_t file_tell(void *userdata)
+{
+	FILE *file = userdata;
+	off_t pos;
+
+	pos = ftello(file);
+	if (pos < 0)
+		return -errno;
+	return pos;
+}
+
+
+static const struct araw_io_ops file_ops = {
+	.read = file_read,
+	.write = file_write,
+	.seek = file_seek,
+	.tell = file_tell,
+};
+
+
+/* Memory backend */
+
+static ssize_t mem_read(void *userdata, void *buf, size_t len)
+{
+	struct araw_io *io = userdata;
+
+	if (io->mem_pos >= io->mem_len)
+		return 0;
+	if (len > io->mem_len - io->mem_pos)
+		len = io->mem_len - io->mem_pos;
+	memcpy(buf, io->mem + io->mem_pos, len);
+	io->mem_pos += len;
+	return len;
+}
+
+
+static ssize_t mem_write(void *userdata, const void *buf, size_t len)
+{
+	struct araw_io *io = userdata;
+
+	if (io->mem_pos > io->mem_size || len > io->mem_size - io->mem_pos)
+		return -ENOSPC;
+	memcpy(io->mem + io->mem_pos, buf, len);
+	io->mem_pos += len;
+	if (io->mem_pos > io->mem_len)
+		io->mem_len = io->mem_pos;
+	if (io->mem_len_out != NULL)
+		*io->mem_len_out = io->mem_len;
+	return len;
+}
+
+
+static int mem_seek(void *userdata, int64_t offset, int whence)
+{
+	struct araw_io *io = userdata;
+	int64_t pos;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (int64_t)io->mem_pos + offset;
+		break;
+	case SEEK_END:
+		pos = (int64_t)io->mem_len + offset;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (pos < 0 || (uint64_t)pos > io->mem_size)
+		return -EINVAL;
+
+	io->mem_pos = pos;
+	return 0;
+}
+
+
+static int64_t mem_tell(void *userdata)
+{
+	struct araw_io *io = userdata;
+
+	return io->mem_pos;
+}
+
+
+static const struct araw_io_ops mem_ops = {
+	.read = mem_read,
+	.write = mem_write,
+	.seek = mem_seek,
+	.tell = mem_tell,
+};
+
+
+/* Clear everything but the statistics, which can be read at any time
+ * from another thread and are kept when the backend changes */
+static void io_reset(struct araw_io *io)
+{
+	memset(io, 0, offsetof(struct araw_io, stats));
+}
+
+
+void araw_io_init_file(struct araw_io *io, FILE *file)
+{
+	io_reset(io);
+	io->ops = &file_ops;
+	io->userdata = file;
+	io->file = file;
+}
+
+
+void araw_io_init_ops(struct araw_io *io,
+		      const struct araw_io_ops *ops,
+		      void *userdata)
+{
+	io_reset(io);
+	io->ops = ops;
+	io->userdata = userdata;
+}
+
+
+void araw_io_init_mem(struct araw_io *io,
+		      uint8_t *data,
+		      size_t size,
+		      size_t len)
+{
+	io_reset(io);
+	io->ops = &mem_ops;
+	io->userdata = io;
+	io->mem = data;
+	io->mem_size = size;
+	io->mem_len = len;
+}
+
+
+int araw_io_close(struct araw_io *io)
+{
+	int ret = 0;
+
+	if (io->file != NULL && fclose(io->file) != 0) {
+		ret = -errno;
+		ULOG_ERRNO("fclose", -ret);
+	}
+	if (io->uring != NULL)
+		ret = araw_io_close_uring(io);
+	free(io->unread);
+	io_reset(io);
+
+	return ret;
+}
+
+
+int araw_io_unread(struct araw_io *io, const void *buf, size_t len)
+{
+	uint8_t *tmp;
+
+	if (len == 0)
+		return 0;
+
+	tmp = malloc(io->unread_len - io->unread_pos + len);
+	if (tmp == NULL)
+		return -ENOMEM;
+	memcpy(tmp, buf, len);
+	memcpy(tmp + len,
+	       io->unread + io->unread_pos,
+	       io->unread_len - io->unread_pos);
+	free(io->unread);
+	io->unread = tmp;
+	io->unread_len = io->unread_len - io->unread_pos + len;
+	io->unread_pos = 0;
+
+	return 0;
+}
+
+
+static void unread_drop(struct araw_io *io)
+{
+	free(io->unread);
+	io->unread = NULL;
+	io->unread_len = 0;
+	io->unread_pos = 0;
+}
+
+
+ssize_t araw_io_read(struct araw_io *io, void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t n = 0;
+
+	if (io->unread != NULL) {
+		/* Data given back first */
+		n = io->unread_len - io->unread_pos;
+		if (n > len)
+			n = len;
+		memcpy(buf, io->unread + io->unread_pos, n);
+		io->unread_pos += n;
+		if (io->unread_pos == io->unread_len)
+			unread_drop(io);
+	}
+
+	/* Callbacks may return less than requested before the end */
+	while (n < len) {
+		ret = io->ops->read(io->userdata, (uint8_t *)buf + n, len - n);
+		araw_stats_io_add(&io->stats,
+				  1,
+				  ret > 0 ? ret : 0,
+				  ret >= 0 && (size_t)ret < len - n,
+				  false);
+		if (ret < 0) {
+			if (ret == -EINTR)
+				continue;
+			return n > 0 ? (ssize_t)n : ret;
+		} else if (ret == 0) {
+			break;
+		}
+		n += ret;
+	}
+
+	return n;
+}
+
+
+int araw_io_write(struct araw_io *io, const void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t n = 0;
+
+	if (io->ops->write == NULL)
+		return -EOPNOTSUPP;
+
+	while (n < len) {
+		ret = io->ops->write(
+			io->userdata, (const uint8_t *)buf + n, len - n);
+		araw_stats_io_add(&io->stats,
+				  1,
+				  ret > 0 ? ret : 0,
+				  ret >= 0 && (size_t)ret < len - n,
+				  false);
+		if (ret < 0) {
+			if (ret == -EINTR)
+				continue;
+			return ret;
+		} else if (ret == 0) {
+			return -EIO;
+		}
+		n += ret;
+	}
+
+	return 0;
+}
+
+
+int araw_io_writev(struct araw_io *io, const struct iovec *iov, int iovcnt)
+{
+	int ret, i = 0, n;
+	ssize_t len;
+	size_t offset = 0, want;
+	struct iovec batch[ARAW_IOV_BATCH];
+
+	if (io->file == NULL || iovcnt == 1) {
+		/* No vectored write through callbacks; single buffers go
+		 * through stdio buffering */
+		for (i = 0; i < iovcnt; i++) {
+			ret = araw_io_write(io, iov[i].iov_base, iov[i].iov_len);
+			if (ret < 0)
+				return ret;
+		}
+		return 0;
+	}
+
+	/* Write the stdio buffer first, then write straight to the file
+	 * descriptor */
+	if (fflush(io->file) != 0) {
+		ret = -errno;
+		ULOG_ERRNO("fflush", -ret);
+		return ret;
+	}
+
+	while (i < iovcnt) {
+		/* Remaining buffers, the first one starting at offset */
+		want = 0;
+		for (n = 0; n < ARAW_IOV_BATCH && i + n < iovcnt; n++) {
+			batch[n] = iov[i + n];
+			want += batch[n].iov_len;
+		}
+		batch[0].iov_base = (uint8_t *)batch[0].iov_base + offset;
+		batch[0].iov_len -= offset;
+		want -= offset;
+
+		len = writev(fileno(io->file), batch, n);
+		araw_stats_io_add(&io->stats,
+				  1,
+				  len > 0 ? len : 0,
+				  len >= 0 && (size_t)len < want,
+				  false);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			ULOG_ERRNO("writev", -ret);
+			return ret;
+		} else if (len == 0 && want > 0) {
+			return -EIO;
+		}
+
+		/* Skip the buffers written */
+		len += offset;
+		while (i < iovcnt && (size_t)len >= iov[i].iov_len) {
+			len -= iov[i].iov_len;
+			i++;
+		}
+		offset = len;
+	}
+
+	return 0;
+}
+
+
+int araw_io_seek(struct araw_io *io, int64_t offset, int whence)
+{
+	if (io->ops->seek == NULL)
+		return -ESPIPE;
+	if (io->unread != NULL) {
+		/* The position is behind the data given back */
+		if (whence == SEEK_CUR)
+			offset -= io->unread_len - io->unread_pos;
+		unread_drop(io);
+	}
+	araw_stats_io_add(&io->stats, 1, 0, false, true);
+	return io->ops->seek(io->userdata, offset, whence);
+}
+
+
+int64_t araw_io_tell(struct araw_io *io)
+{
+	int64_t pos;
+
+	if (io->ops->tell == NULL)
+		return -ESPIPE;
+	araw_stats_io_add(&io->stats, 1, 0, false, false);
+	pos = io->ops->tell(io->userdata);
+	if (pos < 0)
+		return pos;
+	return pos - (int64_t)(io->unread_len - io->unread_pos);
+}
+
+
+int64_t araw_io_size(struct araw_io *io)
+{
+	int ret;
+	int64_t pos, size;
+
+	pos = araw_io_tell(io);
+	if (pos < 0)
+		return pos;
+	ret = araw_io_seek(io, 0, SEEK_END);
+	if (ret < 0)
+		return ret;
+	size = araw_io_tell(io);
+	ret = araw_io_seek(io, pos, SEEK_SET);
+	if (ret < 0)
+		return ret;
+
+	return size;
+}
+
+
+int araw_io_fd(struct araw_io *io)
+{
+	return io->file != NULL ? fileno(io->file) : -1;
+}
+
+
+int araw_io_pread_fd(struct araw_io *io)
+{
+	if (io->uring != NULL)
+		return araw_io_uring_fd(io);
+	return araw_io_fd(io);
+}
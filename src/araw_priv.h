@@ -27,17 +27,67 @@
 #ifndef _ARAW_PRIV_H_
 #define _ARAW_PRIV_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+
 #include <audio-raw/araw.h>
 
 #define DEFAULT_FRAME_LENGTH 1024
 
+#define DEFAULT_TIMESCALE 1000000
+
+#define ARAW_CACHE_LINE_SIZE 64
+
+/* Maximum number of buffers given to a single writev() call */
+#define ARAW_IOV_BATCH 64
+
+/* Default number of frames of a writer written at once by a writer
+ * group */
+#define ARAW_GROUP_QUANTUM 64
+
+/* Number of files in the WAVE header cache */
+#define ARAW_HEADER_CACHE_SIZE 256
+
+/* Set to 0 to build without the I/O statistics */
+#ifndef ARAW_STATS_ENABLED
+#	define ARAW_STATS_ENABLED 1
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#	define ARAW_HOST_LE true
+#else
+#	define ARAW_HOST_LE false
+#endif
+
 #define MAKE_FOURCC(a, b, c, d)                                                \
 	((uint32_t)((a) | (b) << 8 | (c) << 16 | (d) << 24))
 
 #define FOURCC_RIFF MAKE_FOURCC('R', 'I', 'F', 'F')
+#define FOURCC_RF64 MAKE_FOURCC('R', 'F', '6', '4')
+#define FOURCC_BW64 MAKE_FOURCC('B', 'W', '6', '4')
 #define FOURCC_WAVE MAKE_FOURCC('W', 'A', 'V', 'E')
 #define FOURCC_fmt_ MAKE_FOURCC('f', 'm', 't', ' ')
 #define FOURCC_data MAKE_FOURCC('d', 'a', 't', 'a')
+#define FOURCC_ds64 MAKE_FOURCC('d', 's', '6', '4')
+#define FOURCC_JUNK MAKE_FOURCC('J', 'U', 'N', 'K')
+
+/* Size field value meaning "see the ds64 chunk" in RF64/BW64 files */
+#define WAVE_SIZE_DS64 UINT32_MAX
+
+/* fmt chunk format tags */
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+/* Sub-format GUIDs are the format tag followed by this suffix */
+#define WAVE_SUBFORMAT_SUFFIX_SIZE 14
+extern const uint8_t araw_wave_subformat_suffix[WAVE_SUBFORMAT_SUFFIX_SIZE];
 
 /* See: http://soundfile.sapp.org/doc/WaveFormat/ */
 struct wave_header {
@@ -71,4 +121,481 @@ struct wave_header {
 	uint32_t subchunk2_size;
 };
 
+/* Generic RIFF chunk header */
+struct wave_chunk {
+	uint32_t id;
+	uint32_t size;
+};
+
+/* See: EBU Tech 3306 (RF64) and ITU-R BS.2088 (BW64) */
+struct wave_ds64 {
+	/* Size of the RIFF chunk */
+	uint64_t riff_size;
+	/* Size of the data chunk */
+	uint64_t data_size;
+	/* Number of samples (fact chunk) */
+	uint64_t sample_count;
+	/* Number of entries in the (unused) chunk size table */
+	uint32_t table_length;
+} __attribute__((packed));
+
+/* fmt chunk extension, following the PCM fields (WAVE_FORMAT_EXTENSIBLE;
+ * only cb_size is present for WAVE_FORMAT_IEEE_FLOAT) */
+struct wave_fmt_ext {
+	/* Size of the rest of the extension (22 for WAVE_FORMAT_EXTENSIBLE) */
+	uint16_t cb_size;
+	/* Number of significant bits in each sample container */
+	uint16_t valid_bits_per_sample;
+	/* Speaker position of each channel (SPEAKER_* bits) */
+	uint32_t channel_mask;
+	/* Format tag followed by araw_wave_subformat_suffix */
+	uint16_t sub_format;
+	uint8_t sub_format_suffix[WAVE_SUBFORMAT_SUFFIX_SIZE];
+} __attribute__((packed));
+
+
+/* Parsed WAVE header, as stored in the header cache */
+struct araw_header_info {
+	struct wave_header header;
+	struct wave_fmt_ext fmt_ext;
+	/* Offset and size of the PCM data */
+	uint64_t data_offset;
+	uint64_t data_size;
+	/* Chunk directory */
+	struct araw_chunk *chunks;
+	unsigned int chunk_count;
+};
+
+
+/* Look up the header of a file; the chunk directory is copied into a new
+ * array to be freed by the caller. Returns -ENOENT if the file is not in
+ * the cache or has changed */
+int araw_header_cache_get(const char *path,
+			  const struct stat *st,
+			  struct araw_header_info *info);
+
+
+/* Add or update the header of a file, evicting the least recently used
+ * one if the cache is full */
+void araw_header_cache_put(const char *path,
+			   const struct stat *st,
+			   const struct araw_header_info *info);
+
+
+/* Sample conversion */
+struct araw_convert;
+
+
+typedef void (*araw_convert_fn_t)(const struct araw_convert *conv,
+				  uint8_t *dst,
+				  const uint8_t *src,
+				  size_t count);
+
+
+struct araw_convert {
+	enum araw_sample_format src_format;
+	bool src_le;
+	enum araw_sample_format dst_format;
+	bool dst_le;
+	size_t src_size;
+	size_t dst_size;
+	/* No conversion needed */
+	bool identity;
+	araw_convert_fn_t fn;
+};
+
+
+/* Size in bytes of a sample (0 if unknown) */
+size_t araw_sample_format_size(enum araw_sample_format format);
+
+
+/* Whether a data format can be stored in a WAVE file, its samples being
+ * either integer PCM (sample_format is ARAW_SAMPLE_FORMAT_UNKNOWN) or in
+ * the given sample format */
+bool araw_format_is_supported(const struct adef_format *format,
+			      enum araw_sample_format sample_format);
+
+
+/* Sample format of an integer PCM format (ARAW_SAMPLE_FORMAT_UNKNOWN if not
+ * supported) */
+enum araw_sample_format
+araw_sample_format_from_adef(const struct adef_format *format);
+
+
+/* Update the bit depth, signedness and endianness of a PCM format to
+ * match a sample format in host endianness */
+void araw_sample_format_to_adef(enum araw_sample_format sample_format,
+				struct adef_format *format);
+
+
+/* Select the best conversion kernel for the running CPU */
+int araw_convert_init(struct araw_convert *conv,
+		      enum araw_sample_format src_format,
+		      bool src_le,
+		      enum araw_sample_format dst_format,
+		      bool dst_le);
+
+
+/* Convert count samples (all channels) */
+static inline void araw_convert_run(const struct araw_convert *conv,
+				    uint8_t *dst,
+				    const uint8_t *src,
+				    size_t count)
+{
+	if (conv->identity)
+		memcpy(dst, src, count * conv->src_size);
+	else
+		conv->fn(conv, dst, src, count);
+}
+
+
+/* Planar (non-interleaved) layout conversion */
+struct araw_planar;
+
+
+/* Split count interleaved samples per channel into planes stride bytes
+ * apart */
+typedef void (*araw_deinterleave_fn_t)(const struct araw_planar *planar,
+				       uint8_t *dst,
+				       size_t stride,
+				       const uint8_t *src,
+				       size_t count);
+
+
+/* Merge count samples per channel from planes stride bytes apart */
+typedef void (*araw_interleave_fn_t)(const struct araw_planar *planar,
+				     uint8_t *dst,
+				     const uint8_t *src,
+				     size_t stride,
+				     size_t count);
+
+
+struct araw_planar {
+	unsigned int channel_count;
+	size_t sample_size;
+	araw_deinterleave_fn_t deinterleave;
+	araw_interleave_fn_t interleave;
+};
+
+
+/* Select the best planar kernels for the running CPU */
+int araw_planar_init(struct araw_planar *planar,
+		     unsigned int channel_count,
+		     size_t sample_size);
+
+
+/* Statistics are grouped in blocks updated by a single thread and guarded
+ * by a sequence counter (odd while an update is in progress), so that they
+ * can be read consistently from any thread without locking */
+
+/* I/O statistics, updated by the thread doing the I/O */
+struct araw_stats_io {
+	unsigned int seq;
+	uint64_t bytes;
+	uint64_t calls;
+	uint64_t seeks;
+	uint64_t short_count;
+	/* Header updates (writer only) */
+	struct araw_latency_stats header;
+};
+
+
+/* Frame statistics, updated by the API caller thread */
+struct araw_stats_frames {
+	unsigned int seq;
+	uint64_t frames;
+	struct araw_latency_stats latency;
+};
+
+
+void araw_latency_stats_add(struct araw_latency_stats *stats, uint64_t ns);
+
+
+/* Copy a statistics block of size bytes starting with its sequence
+ * counter, retrying while it is being updated */
+void araw_stats_read(const unsigned int *seq, void *dst, size_t size);
+
+
+static inline void araw_stats_update_begin(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static inline void araw_stats_update_end(unsigned int *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Monotonic time in nanoseconds (0 without statistics) */
+static inline uint64_t araw_stats_now(void)
+{
+#if ARAW_STATS_ENABLED
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+
+/* I/O of bytes bytes in calls calls (0 for memory mapped data) */
+static inline void araw_stats_io_add(struct araw_stats_io *stats,
+				     unsigned int calls,
+				     uint64_t bytes,
+				     bool short_io,
+				     bool seek)
+{
+#if ARAW_STATS_ENABLED
+	araw_stats_update_begin(&stats->seq);
+	stats->bytes += bytes;
+	stats->calls += calls;
+	if (short_io)
+		stats->short_count++;
+	if (seek)
+		stats->seeks++;
+	araw_stats_update_end(&stats->seq);
+#endif
+}
+
+
+/* Header update that started at start (araw_stats_now() time) */
+static inline void araw_stats_header_add(struct araw_stats_io *stats,
+					 uint64_t start)
+{
+#if ARAW_STATS_ENABLED
+	uint64_t ns = araw_stats_now() - start;
+
+	araw_stats_update_begin(&stats->seq);
+	araw_latency_stats_add(&stats->header, ns);
+	araw_stats_update_end(&stats->seq);
+#endif
+}
+
+
+/* API call for count frames that started at start (araw_stats_now()
+ * time) */
+static inline void araw_stats_frames_add(struct araw_stats_frames *stats,
+					 unsigned int count,
+					 uint64_t start)
+{
+#if ARAW_STATS_ENABLED
+	uint64_t ns = araw_stats_now() - start;
+
+	araw_stats_update_begin(&stats->seq);
+	stats->frames += count;
+	araw_latency_stats_add(&stats->latency, ns);
+	araw_stats_update_end(&stats->seq);
+#endif
+}
+
+
+struct araw_uring_file;
+
+
+/* I/O backend: a stdio file, caller-supplied callbacks, a memory
+ * region or a file accessed through io_uring */
+struct araw_io {
+	const struct araw_io_ops *ops;
+	void *userdata;
+	/* stdio file (NULL for other backends) */
+	FILE *file;
+	/* Memory region (NULL for other backends) */
+	uint8_t *mem;
+	size_t mem_size;
+	size_t mem_len;
+	size_t mem_pos;
+	/* Updated with mem_len on writes (optional) */
+	size_t *mem_len_out;
+	/* io_uring file (NULL for other backends) */
+	struct araw_uring_file *uring;
+	/* Data given back, read again before the stream */
+	uint8_t *unread;
+	size_t unread_len;
+	size_t unread_pos;
+	/* Last member: kept by the init functions and araw_io_close() */
+	struct araw_stats_io stats;
+};
+
+
+/* The io takes the ownership of the file */
+void araw_io_init_file(struct araw_io *io, FILE *file);
+
+
+/* The io takes the ownership of the file descriptor; the I/O is done
+ * through a ring shared by the process when available, otherwise using
+ * pread()/pwrite() */
+int araw_io_init_uring(struct araw_io *io, int fd);
+
+
+/* Called by araw_io_close() */
+int araw_io_close_uring(struct araw_io *io);
+
+
+void araw_io_init_ops(struct araw_io *io,
+		      const struct araw_io_ops *ops,
+		      void *userdata);
+
+
+/* Memory region of size bytes, the first len bytes being valid */
+void araw_io_init_mem(struct araw_io *io,
+		      uint8_t *data,
+		      size_t size,
+		      size_t len);
+
+
+int araw_io_close(struct araw_io *io);
+
+
+/* Read len bytes, less only at end of stream; returns the number of bytes
+ * read or a negative errno value */
+ssize_t araw_io_read(struct araw_io *io, void *buf, size_t len);
+
+
+/* Give back len bytes read ahead, to be read again by the next reads;
+ * seeking drops them */
+int araw_io_unread(struct araw_io *io, const void *buf, size_t len);
+
+
+/* Write len bytes; returns 0 or a negative errno value */
+int araw_io_write(struct araw_io *io, const void *buf, size_t len);
+
+
+/* Write iovcnt buffers; on stdio files, several buffers are written with
+ * a single system call per ARAW_IOV_BATCH buffers. Returns 0 or a negative
+ * errno value */
+int araw_io_writev(struct araw_io *io, const struct iovec *iov, int iovcnt);
+
+
+/* Returns -ESPIPE if the backend cannot seek */
+int araw_io_seek(struct araw_io *io, int64_t offset, int whence);
+
+
+int64_t araw_io_tell(struct araw_io *io);
+
+
+/* Total size of the stream (-ESPIPE if unknown) */
+int64_t araw_io_size(struct araw_io *io);
+
+
+/* File descriptor of a stdio file backend, -1 otherwise */
+int araw_io_fd(struct araw_io *io);
+
+
+/* File descriptor usable for positional reads (stdio file or io_uring
+ * backend), -1 otherwise */
+int araw_io_pread_fd(struct araw_io *io);
+
+
+/* File descriptor of an io_uring backend */
+int araw_io_uring_fd(struct araw_io *io);
+
+
+/* Single-producer single-consumer ring of pre-allocated buffers; the
+ * producer and the consumer can run concurrently without locking */
+struct araw_ring {
+	uint8_t *buf;
+	size_t *lengths;
+	size_t slot_size;
+	unsigned int count;
+	/* Written by the producer only */
+	unsigned int head __attribute__((aligned(ARAW_CACHE_LINE_SIZE)));
+	/* Written by the consumer only */
+	unsigned int tail __attribute__((aligned(ARAW_CACHE_LINE_SIZE)));
+};
+
+
+int araw_ring_init(struct araw_ring *ring, unsigned int count, size_t slot_size);
+
+
+void araw_ring_clear(struct araw_ring *ring);
+
+
+/* Drop all the filled slots; neither the producer nor the consumer must be
+ * running */
+void araw_ring_reset(struct araw_ring *ring);
+
+
+/* Number of filled slots */
+unsigned int araw_ring_level(struct araw_ring *ring);
+
+
+/* Producer side: get the next free slot (NULL if the ring is full), then
+ * commit it once filled */
+uint8_t *araw_ring_push_get(struct araw_ring *ring);
+
+
+void araw_ring_push_commit(struct araw_ring *ring, size_t len);
+
+
+/* Consumer side: get the next filled slot (NULL if the ring is empty), then
+ * commit it once consumed */
+uint8_t *araw_ring_pop_get(struct araw_ring *ring, size_t *len);
+
+
+void araw_ring_pop_commit(struct araw_ring *ring);
+
+
+/* Consumer side: get the filled slot at the given index from the next one
+ * (NULL if there are not as many filled slots), then commit count slots at
+ * once */
+uint8_t *araw_ring_peek(struct araw_ring *ring,
+			unsigned int index,
+			size_t *len);
+
+
+void araw_ring_pop_commit_count(struct araw_ring *ring, unsigned int count);
+
+
+/* Name of a segment file: the file name with the index inserted before
+ * the extension (if any); to be freed by the caller */
+char *araw_segment_name(const char *filename, unsigned int index);
+
+
+/* Segments read as a single stream using araw_segments_ops; the
+ * configuration is filled with the format of the first segment */
+struct araw_segments;
+
+
+extern const struct araw_io_ops araw_segments_ops;
+
+
+int araw_segments_new(const char *const *filenames,
+		      unsigned int count,
+		      struct araw_reader_config *config,
+		      struct araw_segments **ret_obj);
+
+
+void araw_segments_destroy(struct araw_segments *self);
+
+
+/* Total data size of the segments */
+uint64_t araw_segments_size(struct araw_segments *self);
+
+
+/* Writer group, called by the writer */
+int araw_writer_group_attach(struct araw_writer_group *group,
+			     struct araw_writer *writer);
+
+
+void araw_writer_group_detach(struct araw_writer_group *group,
+			      struct araw_writer *writer);
+
+
+/* Wake the scheduler thread up; never blocks */
+void araw_writer_group_notify(struct araw_writer_group *group);
+
+
+/* Writer, called by the writer group scheduler thread: write the queued
+ * frames, at most max in a single write using iov; returns the number of
+ * frames written. Errors are reported by the next writer call */
+unsigned int araw_writer_async_write(struct araw_writer *self,
+				     struct iovec *iov,
+				     unsigned int max);
+
+
 #endif /* !_ARAW_PRIV_H_ */
@@ -0,0 +1,293 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+
+#define DEFAULT_SEGMENT_LENGTH 65536
+
+/* Retry delay when the asynchronous writer queue is full */
+#define WRITE_RETRY_DELAY_NS 1000000
+
+
+struct araw_process {
+	struct araw_reader *reader;
+	struct araw_writer *writer;
+	struct araw_process_config cfg;
+	/* Sizes of a sample (all channels) */
+	size_t in_sample_size;
+	size_t out_sample_size;
+
+	/* Next segment to process, written atomically by the workers */
+	uint64_t next;
+
+	/* Protected by mutex */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* Next segment to write */
+	uint64_t next_write;
+	/* First segment beyond the end of file */
+	uint64_t end;
+	int err;
+};
+
+
+static void process_set_error(struct araw_process *self, int err)
+{
+	pthread_mutex_lock(&self->mutex);
+	if (self->err == 0)
+		self->err = err;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+
+static int
+process_write(struct araw_process *self, uint8_t *data, size_t count)
+{
+	int ret;
+	unsigned int i;
+	struct araw_frame frame;
+	struct timespec delay = {0, WRITE_RETRY_DELAY_NS};
+	size_t size = self->cfg.out_format.bit_depth / 8;
+
+	if (!self->cfg.out_format.pcm.interleaved &&
+	    count < self->cfg.segment_length) {
+		/* Make the planes of the last segment contiguous */
+		for (i = 1; i < self->cfg.out_format.channel_count; i++)
+			memmove(data + i * count * size,
+				data + i * self->cfg.segment_length * size,
+				count * size);
+	}
+
+	memset(&frame, 0, sizeof(frame));
+	frame.cdata = data;
+	frame.cdata_length = count * self->out_sample_size;
+	frame.frame.format = self->cfg.out_format;
+
+	/* Wait for the writer thread to make room in asynchronous mode */
+	while ((ret = araw_writer_frame_write(self->writer, &frame)) ==
+	       -EAGAIN)
+		nanosleep(&delay, NULL);
+	if (ret < 0)
+		ULOG_ERRNO("araw_writer_frame_write", -ret);
+
+	return ret;
+}
+
+
+/* Write a processed segment once all the previous ones are written */
+static int process_commit(struct araw_process *self,
+			  uint64_t segment,
+			  uint8_t *data,
+			  size_t count)
+{
+	int ret;
+
+	pthread_mutex_lock(&self->mutex);
+	while (self->err == 0 && self->next_write != segment)
+		pthread_cond_wait(&self->cond, &self->mutex);
+	ret = self->err;
+	pthread_mutex_unlock(&self->mutex);
+	if (ret < 0)
+		return ret;
+
+	/* Only this thread writes until next_write is incremented */
+	if (self->writer != NULL && count > 0) {
+		ret = process_write(self, data, count);
+		if (ret < 0)
+			return ret;
+	}
+
+	pthread_mutex_lock(&self->mutex);
+	self->next_write++;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+
+	return 0;
+}
+
+
+static void *process_thread(void *ptr)
+{
+	int ret = 0;
+	ssize_t count;
+	struct araw_process *self = ptr;
+	size_t length = self->cfg.segment_length;
+	uint64_t segment;
+	uint8_t *in, *out = NULL;
+
+	in = malloc(length * self->in_sample_size);
+	if (self->writer != NULL)
+		out = malloc(length * self->out_sample_size);
+	if (in == NULL || (self->writer != NULL && out == NULL)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while (1) {
+		segment = __atomic_fetch_add(&self->next, 1, __ATOMIC_RELAXED);
+		if (segment > UINT64_MAX / length)
+			break;
+
+		pthread_mutex_lock(&self->mutex);
+		ret = self->err;
+		if (ret == 0 && segment >= self->end)
+			ret = -ENOENT;
+		pthread_mutex_unlock(&self->mutex);
+		if (ret < 0)
+			break;
+
+		count = araw_reader_read_range(self->reader,
+					       segment * length,
+					       length,
+					       in,
+					       length * self->in_sample_size);
+		if (count == -ENOENT) {
+			/* Segments are taken in order: no more data */
+			pthread_mutex_lock(&self->mutex);
+			if (segment < self->end)
+				self->end = segment;
+			pthread_mutex_unlock(&self->mutex);
+			ret = 0;
+			break;
+		} else if (count < 0) {
+			ret = count;
+			ULOG_ERRNO("araw_reader_read_range", (int)-ret);
+			break;
+		}
+
+		ret = self->cfg.process(
+			in, out, count, segment * length, self->cfg.userdata);
+		if (ret < 0) {
+			ULOG_ERRNO("process", -ret);
+			break;
+		}
+
+		ret = process_commit(self, segment, out, count);
+		if (ret < 0)
+			break;
+	}
+
+out:
+	if (ret < 0 && ret != -ENOENT)
+		process_set_error(self, ret);
+	free(in);
+	free(out);
+	return NULL;
+}
+
+
+int araw_process(struct araw_reader *reader,
+		 struct araw_writer *writer,
+		 const struct araw_process_config *config)
+{
+	int ret;
+	long cpus;
+	unsigned int i, launched = 0;
+	pthread_t *threads = NULL;
+	struct araw_reader_config rcfg;
+	struct araw_process self;
+
+	ULOG_ERRNO_RETURN_ERR_IF(reader == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->process == NULL, EINVAL);
+	if (writer != NULL) {
+		ULOG_ERRNO_RETURN_ERR_IF(config->out_format.channel_count == 0,
+					 EINVAL);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			config->out_format.bit_depth == 0 ||
+				config->out_format.bit_depth % 8 != 0,
+			EINVAL);
+	}
+
+	ret = araw_reader_get_config(reader, &rcfg);
+	if (ret < 0)
+		return ret;
+
+	memset(&self, 0, sizeof(self));
+	self.reader = reader;
+	self.writer = writer;
+	self.cfg = *config;
+	self.end = UINT64_MAX;
+	if (self.cfg.segment_length == 0)
+		self.cfg.segment_length = DEFAULT_SEGMENT_LENGTH;
+	if (self.cfg.thread_count == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		self.cfg.thread_count = cpus > 0 ? cpus : 1;
+	}
+	self.in_sample_size = rcfg.format.channel_count *
+			      araw_sample_format_size(rcfg.sample_format);
+	self.out_sample_size = self.cfg.out_format.channel_count *
+			       (self.cfg.out_format.bit_depth / 8);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		self.cfg.segment_length > SIZE_MAX / self.in_sample_size,
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		writer != NULL && self.cfg.segment_length >
+					  SIZE_MAX / self.out_sample_size,
+		EINVAL);
+
+	threads = calloc(self.cfg.thread_count, sizeof(*threads));
+	if (threads == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&self.mutex, NULL);
+	pthread_cond_init(&self.cond, NULL);
+
+	for (i = 0; i < self.cfg.thread_count; i++) {
+		ret = pthread_create(
+			&threads[launched], NULL, process_thread, &self);
+		if (ret != 0) {
+			ULOG_ERRNO("pthread_create", ret);
+			/* Carry on with the threads already launched */
+			if (launched == 0) {
+				self.err = -ret;
+				break;
+			}
+			continue;
+		}
+		launched++;
+	}
+	for (i = 0; i < launched; i++)
+		pthread_join(threads[i], NULL);
+
+	ret = self.err;
+	pthread_cond_destroy(&self.cond);
+	pthread_mutex_destroy(&self.mutex);
+	free(threads);
+
+	return ret;
+}
@@ -25,277 +25,2174 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#	include <sys/timerfd.h>
+#endif
 
 #include "araw_priv.h"
 
 #define ULOG_TAG araw
 #include <ulog.h>
 
-#include <pthread.h>
-#define NB_SUPPORTED_FORMATS 24
-static struct adef_format supported_formats[NB_SUPPORTED_FORMATS];
-static pthread_once_t supported_formats_is_init = PTHREAD_ONCE_INIT;
-static void initialize_supported_formats(void)
-{
-	int i = 0;
-	supported_formats[i++] = adef_pcm_16b_8000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_8000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_11025hz_mono;
-	supported_formats[i++] = adef_pcm_16b_11025hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_12000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_12000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_16000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_16000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_22050hz_mono;
-	supported_formats[i++] = adef_pcm_16b_22050hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_24000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_24000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_32000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_32000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_44100hz_mono;
-	supported_formats[i++] = adef_pcm_16b_44100hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_48000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_48000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_64000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_64000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_88200hz_mono;
-	supported_formats[i++] = adef_pcm_16b_88200hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_96000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_96000hz_stereo;
-}
+
+/* Number of samples (per channel) converted at once by
+ * araw_reader_read_range() */
+#define RANGE_CHUNK_LENGTH 1024
+
+/* Size of the reads of the file head while walking the chunks */
+#define HEADER_WINDOW_SIZE 4096
 
 
 struct araw_reader {
 	char *filename;
-	FILE *file;
+	struct araw_io io;
 	struct araw_reader_config cfg;
 	struct wave_header header;
-	uint32_t data_length;
+	struct wave_fmt_ext fmt_ext;
+	/* Sample format in the file */
+	enum araw_sample_format file_sample_format;
+	/* Total and remaining PCM data length */
+	uint64_t data_size;
+	uint64_t data_length;
 	int index;
-	float timestamp;
+	/* Number of samples (per channel) before the next frame */
+	uint64_t sample_index;
+	/* Output frame size */
 	size_t frame_size;
+	/* Frame and sample (all channels) sizes in the file */
+	size_t file_frame_size;
+	size_t sample_size;
+	/* Sample conversion */
+	struct araw_convert conv;
+	uint8_t *scratch;
+	/* Planar output */
+	struct araw_planar planar;
+	size_t plane_stride;
+	uint8_t *interleaved;
+	/* Frames can be given straight from the file */
+	bool zero_copy;
+	/* Offset of the PCM data in the file (current offset while parsing
+	 * the header) */
+	off_t data_offset;
+	/* Chunk directory */
+	struct araw_chunk *chunks;
+	unsigned int chunk_count;
+	/* File status, for the header cache (araw_reader_new() only) */
+	struct stat st;
+	bool st_valid;
+	/* Segment files read as a single stream (araw_reader_new_segments()
+	 * only) */
+	struct araw_segments *segments;
+	/* File mapping (mmap mode only) */
+	uint8_t *map;
+	size_t map_size;
+	unsigned int borrowed;
+	/* File descriptor for positional reads (-1 if not seekable) */
+	int pread_fd;
+
+	/* Frame pool: pool_size buffers pool_stride bytes apart, and their
+	 * reference counts (0 if free) */
+	uint8_t *pool;
+	size_t pool_stride;
+	unsigned int *pool_refs;
+	/* Next buffer to try (borrowing thread only) */
+	unsigned int pool_next;
+	/* API calls statistics */
+	struct araw_stats_frames stats;
+
+	/* Loop mode: PCM data loaded in memory (NULL if read from a memory
+	 * buffer) */
+	uint8_t *loop_buf;
+
+	/* Paced mode: timer file descriptor (-1 if not paced), time of the
+	 * first frame on the monotonic clock in nanoseconds, and number of
+	 * frames read since */
+	int pace_fd;
+	bool pace_started;
+	uint64_t pace_start;
+	uint64_t pace_count;
+
+	/* Prefetch mode */
+	struct araw_ring ring;
+	pthread_t thread;
+	bool thread_launched;
+	sem_t sem;
+	bool sem_created;
+	int stop;
+	int eof;
+	int prefetch_err;
 };
 
 
-static int wave_header_read(struct araw_reader *self)
+static int file_read(struct araw_reader *self, void *ptr, size_t len)
 {
-	int ret;
+	ssize_t ret;
+
+	if (len == 0)
+		return 0;
 
-	ret = fread(&self->header, sizeof(self->header), 1, self->file);
+	ret = araw_io_read(&self->io, ptr, len);
 	if (ret < 0) {
-		ret = -errno;
-		ULOG_ERRNO("fread", -ret);
+		ULOG_ERRNO("read", (int)-ret);
 		return ret;
+	} else if ((size_t)ret != len) {
+		ULOGE("unexpected end of file");
+		return -EPROTO;
 	}
+	self->data_offset += len;
 
-	ULOG_ERRNO_RETURN_ERR_IF(self->header.chunk_id != FOURCC_RIFF, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(self->header.format != FOURCC_WAVE, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(self->header.subchunk1_id != FOURCC_fmt_,
-				 EINVAL);
+	return 0;
+}
 
-	bool additional_header_data_present = false;
-	while (self->header.subchunk2_id != FOURCC_data) {
-#if UINT32_MAX > LONG_MAX
-		ULOG_ERRNO_RETURN_ERR_IF(
-			self->header.subchunk2_size >= LONG_MAX, EINVAL);
-#endif
-		ret = fseek(self->file, self->header.subchunk2_size, SEEK_CUR);
-		if (ret < 0) {
-			ret = -errno;
-			ULOG_ERRNO("fseek", -ret);
-			return ret;
-		}
-		ret = fread(&self->header.subchunk2_id,
-			    sizeof(self->header.subchunk2_id),
-			    1,
-			    self->file);
-		if (ret < 0) {
-			ret = -errno;
-			ULOG_ERRNO("fread", -ret);
-			return ret;
+
+static int file_skip(struct araw_reader *self, uint64_t len)
+{
+	int ret;
+
+	if (len == 0)
+		return 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(len > INT64_MAX, EINVAL);
+	ret = araw_io_seek(&self->io, (int64_t)len, SEEK_CUR);
+	if (ret == -ESPIPE) {
+		/* Pipe: read and drop the data */
+		uint8_t buf[4096];
+		size_t n;
+		uint64_t remaining = len;
+		while (remaining > 0) {
+			n = remaining < sizeof(buf) ? remaining : sizeof(buf);
+			ret = file_read(self, buf, n);
+			if (ret < 0)
+				return ret;
+			remaining -= n;
 		}
-		ret = fread(&self->header.subchunk2_size,
-			    sizeof(self->header.subchunk2_size),
-			    1,
-			    self->file);
-		if (ret < 0) {
-			ret = -errno;
-			ULOG_ERRNO("fread", -ret);
-			return ret;
+		return 0;
+	} else if (ret < 0) {
+		ULOG_ERRNO("seek", -ret);
+		return ret;
+	}
+	self->data_offset += len;
+
+	return 0;
+}
+
+
+/* Get the data format from the fmt chunk */
+static int wave_fmt_parse(struct araw_reader *self)
+{
+	unsigned int format_tag = self->header.audio_format;
+	unsigned int bits = self->header.bits_per_sample;
+
+	self->cfg.channel_mask = 0;
+	self->cfg.valid_bits = bits;
+
+	if (format_tag == WAVE_FORMAT_EXTENSIBLE) {
+		ULOG_ERRNO_RETURN_ERR_IF(self->fmt_ext.cb_size <
+						 sizeof(self->fmt_ext) -
+							 sizeof(uint16_t),
+					 EINVAL);
+		if (memcmp(self->fmt_ext.sub_format_suffix,
+			   araw_wave_subformat_suffix,
+			   WAVE_SUBFORMAT_SUFFIX_SIZE) != 0) {
+			ULOGE("unsupported WAVE_FORMAT_EXTENSIBLE sub-format");
+			return -ENOTSUP;
 		}
-		additional_header_data_present = true;
+		format_tag = self->fmt_ext.sub_format;
+		self->cfg.channel_mask = self->fmt_ext.channel_mask;
+		if (self->fmt_ext.valid_bits_per_sample != 0)
+			self->cfg.valid_bits =
+				self->fmt_ext.valid_bits_per_sample;
+		ULOG_ERRNO_RETURN_ERR_IF(self->cfg.valid_bits > bits, EINVAL);
 	}
 
-	ULOG_ERRNO_RETURN_ERR_IF(self->header.subchunk2_id != FOURCC_data,
-				 EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(
-		self->header.audio_format != ADEF_WAVE_FORMAT_PCM, EINVAL);
+	switch (format_tag) {
+	case WAVE_FORMAT_PCM:
+		switch (bits) {
+		case 8:
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_U8;
+			break;
+		case 16:
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_S16;
+			break;
+		case 24:
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_S24;
+			break;
+		case 32:
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_S32;
+			break;
+		default:
+			break;
+		}
+		break;
+	case WAVE_FORMAT_IEEE_FLOAT:
+		if (bits == 32)
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_F32;
+		else if (bits == 64)
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_F64;
+		break;
+	default:
+		ULOGE("unsupported WAVE format: 0x%04x", format_tag);
+		return -ENOTSUP;
+	}
 
-	self->data_length = self->header.subchunk2_size;
+	if (self->file_sample_format == ARAW_SAMPLE_FORMAT_UNKNOWN) {
+		ULOGE("unsupported bits per sample: %u", bits);
+		return -ENOTSUP;
+	}
 
 	/* Fill format */
+	self->cfg.wave_format = format_tag;
 	self->cfg.format.encoding = ADEF_ENCODING_PCM;
-	self->cfg.wave_format = self->header.format;
-	self->cfg.format.bit_depth = self->header.bits_per_sample;
 	self->cfg.format.channel_count = self->header.num_channels;
 	self->cfg.format.sample_rate = self->header.sample_rate;
 	/* RIFF WAV file format: little endian
 	 * FIFX WAV file format: big endian */
 	self->cfg.format.pcm.little_endian = true;
 	self->cfg.format.pcm.interleaved = true;
-	/**
+	/* Sets the bit depth and the signedness:
 	 * Format      Maximum Value   Minimum Value     Midpoint Value
 	 * 8-bit PCM   255 (0xFF)      0                 128 (0x80)
-	 * 16-bit PCM  32767 (0x7FFF)  -32768 (-0x8000)  0
-	 */
-	self->cfg.format.pcm.signed_val = (self->cfg.format.bit_depth > 8);
-	self->cfg.data_length = self->data_length;
+	 * 16-bit PCM  32767 (0x7FFF)  -32768 (-0x8000)  0 */
+	araw_sample_format_to_adef(self->file_sample_format, &self->cfg.format);
+	self->cfg.format.pcm.little_endian = true;
+
+	ULOG_ERRNO_RETURN_ERR_IF(
+		!araw_format_is_supported(&self->cfg.format,
+					  self->file_sample_format),
+		EINVAL);
 
 	return 0;
 }
 
 
-static int
-wave_read_data(struct araw_reader *self, unsigned char *data, size_t len)
+/* Part of the file head being parsed */
+struct header_window {
+	uint8_t buf[HEADER_WINDOW_SIZE];
+	/* Position of buf from the start of the header */
+	uint64_t pos;
+	/* Number of bytes in buf */
+	size_t len;
+};
+
+
+/* Get len bytes at pos from the start of the header, reading the next part
+ * of the file at once if needed; positions must not go backwards */
+static int window_get(struct araw_reader *self,
+		      struct header_window *win,
+		      uint64_t pos,
+		      void *ptr,
+		      size_t len)
 {
-	int n;
-	if (self->file == NULL)
-		return -EINVAL;
-	if (len > self->data_length)
-		len = self->data_length;
-	n = fread(data, 1, len, self->file);
-	self->data_length -= len;
-	return n;
+	ssize_t ret;
+	size_t keep = 0;
+	uint64_t end = win->pos + win->len;
+
+	if (pos >= win->pos && pos + len <= end) {
+		memcpy(ptr, win->buf + (pos - win->pos), len);
+		return 0;
+	}
+
+	ULOG_ERRNO_RETURN_ERR_IF(pos < win->pos || len > sizeof(win->buf),
+				 EPROTO);
+	if (pos < end) {
+		/* Keep the beginning of the requested data */
+		keep = end - pos;
+		memmove(win->buf, win->buf + (pos - win->pos), keep);
+	} else if (pos > end) {
+		ret = file_skip(self, pos - end);
+		if (ret < 0)
+			return ret;
+	}
+	win->pos = pos;
+	win->len = keep;
+
+	ret = araw_io_read(&self->io, win->buf + keep, sizeof(win->buf) - keep);
+	if (ret < 0) {
+		ULOG_ERRNO("read", (int)-ret);
+		return ret;
+	}
+	win->len += ret;
+	if (len > win->len) {
+		ULOGE("unexpected end of file");
+		return -EPROTO;
+	}
+	memcpy(ptr, win->buf, len);
+
+	return 0;
 }
 
 
-int araw_reader_new(const char *filename,
-		    const struct araw_reader_config *config,
-		    struct araw_reader **ret_obj)
+static int chunk_add(struct araw_reader *self,
+		     uint32_t id,
+		     uint64_t offset,
+		     uint64_t size)
 {
-	int ret = 0;
-	struct araw_reader *self = NULL;
+	struct araw_chunk *chunks;
 
-	(void)pthread_once(&supported_formats_is_init,
-			   initialize_supported_formats);
+	chunks = realloc(self->chunks,
+			 (self->chunk_count + 1) * sizeof(*self->chunks));
+	if (chunks == NULL)
+		return -ENOMEM;
+	self->chunks = chunks;
+	chunks[self->chunk_count].id = id;
+	chunks[self->chunk_count].offset = offset;
+	chunks[self->chunk_count].size = size;
+	self->chunk_count++;
 
-	ULOG_ERRNO_RETURN_ERR_IF(filename == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	return 0;
+}
 
-	self = calloc(1, sizeof(*self));
-	if (self == NULL)
-		return -ENOMEM;
 
-	self->cfg = *config;
+static int wave_header_read(struct araw_reader *self)
+{
+	int ret;
+	struct header_window *win;
+	struct wave_chunk chunk;
+	struct wave_ds64 ds64;
+	size_t len;
+	uint64_t pos, start = self->data_offset;
+	bool rf64, fmt_found = false, ds64_found = false;
 
-	if (self->cfg.frame_length == 0)
-		self->cfg.frame_length = DEFAULT_FRAME_LENGTH;
+	memset(&ds64, 0, sizeof(ds64));
 
-	self->filename = strdup(filename);
-	if (self->filename == NULL) {
-		ret = -ENOMEM;
-		goto error;
+	win = calloc(1, sizeof(*win));
+	if (win == NULL)
+		return -ENOMEM;
+
+	/* RIFF header */
+	pos = offsetof(struct wave_header, subchunk1_id);
+	ret = window_get(self, win, 0, &self->header, pos);
+	if (ret < 0)
+		goto out;
+
+	rf64 = (self->header.chunk_id == FOURCC_RF64) ||
+	       (self->header.chunk_id == FOURCC_BW64);
+	if ((self->header.chunk_id != FOURCC_RIFF && !rf64) ||
+	    self->header.format != FOURCC_WAVE) {
+		ULOGE("not a WAVE file");
+		ret = -EINVAL;
+		goto out;
 	}
 
-	self->file = fopen(self->filename, "rb");
-	if (self->file == NULL) {
-		ret = -errno;
-		ULOG_ERRNO("fopen('%s')", -ret, self->filename);
-		goto error;
+	/* Walk the chunks up to the data chunk, from the file head read at
+	 * once */
+	while (1) {
+		ret = window_get(self, win, pos, &chunk, sizeof(chunk));
+		if (ret < 0)
+			goto out;
+		pos += sizeof(chunk);
+
+		ret = chunk_add(self, chunk.id, start + pos, chunk.size);
+		if (ret < 0)
+			goto out;
+
+		if (chunk.id == FOURCC_data)
+			break;
+
+		switch (chunk.id) {
+		case FOURCC_ds64:
+			if (!rf64) {
+				ret = -EINVAL;
+				goto out;
+			}
+			len = chunk.size < sizeof(ds64) ? chunk.size
+							: sizeof(ds64);
+			ret = window_get(self, win, pos, &ds64, len);
+			if (ret < 0)
+				goto out;
+			ds64_found = true;
+			break;
+		case FOURCC_fmt_:
+			len = offsetof(struct wave_header, subchunk2_id) -
+			      offsetof(struct wave_header, audio_format);
+			if (chunk.size < len) {
+				ret = -EINVAL;
+				goto out;
+			}
+			self->header.subchunk1_id = chunk.id;
+			self->header.subchunk1_size = chunk.size;
+			ret = window_get(
+				self, win, pos, &self->header.audio_format, len);
+			if (ret < 0)
+				goto out;
+			fmt_found = true;
+			if (self->header.audio_format != WAVE_FORMAT_EXTENSIBLE)
+				break;
+			if (chunk.size < len + sizeof(self->fmt_ext)) {
+				ret = -EINVAL;
+				goto out;
+			}
+			ret = window_get(self,
+					 win,
+					 pos + len,
+					 &self->fmt_ext,
+					 sizeof(self->fmt_ext));
+			if (ret < 0)
+				goto out;
+			break;
+		default:
+			break;
+		}
+
+		/* Next chunk, after the pad byte */
+		pos += (uint64_t)chunk.size + (chunk.size & 1);
 	}
 
-	/* Read WAVE file header */
-	ret = wave_header_read(self);
+	if (!fmt_found || (rf64 && !ds64_found)) {
+		ULOGE("missing %s chunk", fmt_found ? "ds64" : "fmt");
+		ret = -EINVAL;
+		goto out;
+	}
+	ret = wave_fmt_parse(self);
 	if (ret < 0)
-		goto error;
+		goto out;
 
-	self->frame_size = self->cfg.frame_length *
-			   self->cfg.format.channel_count *
-			   (self->cfg.format.bit_depth / 8);
+	self->header.subchunk2_id = chunk.id;
+	self->header.subchunk2_size = chunk.size;
+	self->data_size = chunk.size;
+	if (rf64 && chunk.size == WAVE_SIZE_DS64) {
+		self->data_size = ds64.data_size;
+		self->chunks[self->chunk_count - 1].size = ds64.data_size;
+	}
+	self->data_length = self->data_size;
+	self->data_offset = start + pos;
 
-	*ret_obj = self;
+	self->cfg.data_length = self->data_length;
 
-	return 0;
+	/* Give back the PCM data read with the header */
+	ret = araw_io_unread(&self->io,
+			     win->buf + (pos - win->pos),
+			     win->pos + win->len - pos);
 
-error:
-	(void)araw_reader_destroy(self);
-	*ret_obj = NULL;
+out:
+	free(win);
 	return ret;
 }
 
 
-int araw_reader_destroy(struct araw_reader *self)
+/* Headerless PCM data: the format is given by the configuration */
+static int raw_header_init(struct araw_reader *self)
 {
-	if (self == NULL)
-		return 0;
+	int ret;
+	int64_t size;
+	struct adef_format *format = &self->cfg.format;
 
-	if (self->file != NULL)
-		fclose(self->file);
+	ULOG_ERRNO_RETURN_ERR_IF(format->encoding != ADEF_ENCODING_PCM, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(format->channel_count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(format->sample_rate == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!format->pcm.interleaved, EINVAL);
+
+	if ((unsigned int)self->cfg.wave_format == WAVE_FORMAT_IEEE_FLOAT) {
+		if (format->bit_depth == 32)
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_F32;
+		else if (format->bit_depth == 64)
+			self->file_sample_format = ARAW_SAMPLE_FORMAT_F64;
+	} else {
+		self->file_sample_format = araw_sample_format_from_adef(format);
+	}
+	if (self->file_sample_format == ARAW_SAMPLE_FORMAT_UNKNOWN) {
+		ULOGE("unsupported raw format: %u bits", format->bit_depth);
+		return -ENOTSUP;
+	}
+	self->cfg.channel_mask = 0;
+	self->cfg.valid_bits = format->bit_depth;
+
+	ret = file_skip(self, self->cfg.raw_offset);
+	if (ret < 0)
+		return ret;
+
+	self->data_size = self->cfg.data_length;
+	if (self->data_size == 0) {
+		/* Up to the end of the file, or of the stream */
+		size = araw_io_size(&self->io);
+		if (size == -ESPIPE) {
+			self->data_size = UINT64_MAX;
+		} else if (size < 0) {
+			ULOG_ERRNO("araw_io_size", (int)-size);
+			return size;
+		} else if (size > self->data_offset) {
+			self->data_size = size - self->data_offset;
+		}
+	}
+	self->data_length = self->data_size;
+	self->cfg.data_length = self->data_length;
 
-	free(self->filename);
-	free(self);
 	return 0;
 }
 
 
-int araw_reader_get_config(struct araw_reader *self,
-			   struct araw_reader_config *config)
+static int wave_map(struct araw_reader *self)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	int ret, fd;
+	struct stat st;
+
+	if (self->io.mem != NULL) {
+		/* The memory region is used as is */
+		ULOG_ERRNO_RETURN_ERR_IF(
+			(uint64_t)self->data_offset > self->io.mem_len, EPROTO);
+		if (self->io.mem_len - self->data_offset < self->data_size) {
+			self->data_size = self->io.mem_len - self->data_offset;
+			self->data_length = self->data_size;
+		}
+		self->map = self->io.mem;
+		self->map_size = self->data_offset + self->data_size;
+		return 0;
+	}
+
+	fd = araw_io_fd(&self->io);
+	ULOG_ERRNO_RETURN_ERR_IF(fd < 0, EOPNOTSUPP);
+
+	ret = fstat(fd, &st);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("fstat", -ret);
+		return ret;
+	}
+
+	/* Only regular files can be mapped */
+	ULOG_ERRNO_RETURN_ERR_IF(!S_ISREG(st.st_mode), EINVAL);
+
+	/* Do not trust the data chunk size over the actual file size */
+	if (st.st_size < self->data_offset)
+		return -EPROTO;
+	if ((uint64_t)(st.st_size - self->data_offset) < self->data_size) {
+		ULOGW("data chunk truncated (%" PRIu64 " bytes expected, "
+		      "%" PRIu64 " available)",
+		      self->data_size,
+		      (uint64_t)(st.st_size - self->data_offset));
+		self->data_size = st.st_size - self->data_offset;
+		self->data_length = self->data_size;
+	}
+
+#if SIZE_MAX < UINT64_MAX
+	ULOG_ERRNO_RETURN_ERR_IF(self->data_size > SIZE_MAX - self->data_offset,
+				 EFBIG);
+#endif
+	self->map_size = self->data_offset + self->data_size;
+	if (self->map_size == 0)
+		return 0;
+
+	self->map = mmap(NULL,
+			 self->map_size,
+			 PROT_READ,
+			 MAP_SHARED,
+			 fd,
+			 0);
+	if (self->map == MAP_FAILED) {
+		ret = -errno;
+		ULOG_ERRNO("mmap('%s')", -ret, self->filename);
+		self->map = NULL;
+		return ret;
+	}
+
+	ret = madvise(self->map, self->map_size, MADV_SEQUENTIAL);
+	if (ret < 0)
+		ULOG_ERRNO("madvise", errno);
 
-	*config = self->cfg;
 	return 0;
 }
 
 
-ssize_t araw_reader_get_min_buf_size(struct araw_reader *self)
+static const uint8_t *wave_map_data(struct araw_reader *self, size_t len)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	const uint8_t *ptr;
 
-	return self->frame_size;
+	if (self->map == NULL || len > self->data_length)
+		return NULL;
+	ptr = self->map + self->map_size - self->data_length;
+	self->data_length -= len;
+	araw_stats_io_add(&self->io.stats, 0, len, false, false);
+	return ptr;
 }
 
 
-int araw_reader_frame_read(struct araw_reader *self,
-			   uint8_t *data,
-			   size_t len,
-			   struct araw_frame *frame)
+static ssize_t
+wave_read_data(struct araw_reader *self, unsigned char *data, size_t len)
 {
 	int ret;
-	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(len == 0, ENOBUFS);
-	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+	ssize_t n;
+	size_t total = 0;
 
-	ULOG_ERRNO_RETURN_ERR_IF(len < self->frame_size, ENOBUFS);
-	ULOG_ERRNO_RETURN_ERR_IF(self->file == NULL, EPROTO);
+	if (self->io.ops == NULL)
+		return -EINVAL;
 
-	/* Read the PCM data */
-	ret = wave_read_data(self, data, len);
-	if (ret < 0) {
-		ULOG_ERRNO("wave_read_data", -ret);
-		return ret;
-	} else if ((size_t)ret != len) {
-		return -ENOENT;
+	if (!self->cfg.loop) {
+		if (len > self->data_length)
+			len = self->data_length;
+		n = araw_io_read(&self->io, data, len);
+		if (n < 0)
+			return n;
+		self->data_length -= len;
+		return n;
 	}
 
-	/* Fill the frame info */
-	frame->frame.format = self->cfg.format;
-	frame->frame.info.timestamp = (uint64_t)self->timestamp;
-	frame->frame.info.timescale = 1000000;
-	frame->frame.info.index = self->index;
+	/* Loop mode: go on from the start of the data at the end */
+	while (total < len) {
+		if (self->data_length == 0) {
+			ret = araw_io_seek(
+				&self->io, self->data_offset, SEEK_SET);
+			if (ret < 0)
+				return ret;
+			self->data_length = self->data_size;
+		}
+		n = len - total;
+		if ((uint64_t)n > self->data_length)
+			n = self->data_length;
+		n = araw_io_read(&self->io, data + total, n);
+		if (n <= 0)
+			return n < 0 ? n : -EIO;
+		self->data_length -= n;
+		total += n;
+	}
 
-	self->index++;
-	self->timestamp += 1000000ULL * self->cfg.frame_length /
-			   self->cfg.format.sample_rate;
+	return total;
+}
+
+
+/* Read up to count frames into data, converted to the output sample format
+ * and layout if needed; returns the number of complete frames read */
+static ssize_t
+frames_get(struct araw_reader *self, uint8_t *data, unsigned int count)
+{
+	ssize_t ret;
+	unsigned int i;
+	size_t len;
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t sample_count =
+		self->cfg.frame_length * self->cfg.format.channel_count;
+
+	if (!self->cfg.loop &&
+	    count > self->data_length / self->file_frame_size)
+		count = self->data_length / self->file_frame_size;
+	if (count == 0)
+		return 0;
+
+	if (self->zero_copy) {
+		len = (size_t)count * self->file_frame_size;
+		if (self->cfg.mmap) {
+			/* Copy the PCM data straight from the mapping */
+			src = wave_map_data(self, len);
+			memcpy(data, src, len);
+			return count;
+		}
+		ret = wave_read_data(self, data, len);
+		if (ret < 0)
+			return ret;
+		/* Only keep the complete frames on short reads */
+		return (size_t)ret / self->file_frame_size;
+	}
+
+	for (i = 0; i < count; i++) {
+		/* Get the file samples */
+		if (self->cfg.mmap) {
+			src = wave_map_data(self, self->file_frame_size);
+		} else {
+			ret = wave_read_data(
+				self, self->scratch, self->file_frame_size);
+			if (ret < 0)
+				return i > 0 ? (ssize_t)i : ret;
+			if ((size_t)ret != self->file_frame_size)
+				break;
+			src = self->scratch;
+		}
+
+		dst = data + i * self->frame_size;
+		if (!self->cfg.planar) {
+			araw_convert_run(&self->conv, dst, src, sample_count);
+			continue;
+		}
+
+		/* Convert, then split the channels */
+		if (!self->conv.identity) {
+			araw_convert_run(&self->conv,
+					 self->interleaved,
+					 src,
+					 sample_count);
+			src = self->interleaved;
+		}
+		self->planar.deinterleave(&self->planar,
+					  dst,
+					  self->plane_stride,
+					  src,
+					  self->cfg.frame_length);
+	}
+
+	return i;
+}
+
+
+static void *reader_thread(void *ptr)
+{
+	ssize_t ret;
+	struct araw_reader *self = ptr;
+	uint8_t *slot;
+
+	while (!__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE)) {
+		slot = araw_ring_push_get(&self->ring);
+		if (slot == NULL) {
+			/* Ring full: wait for the consumer */
+			while (sem_wait(&self->sem) < 0 && errno == EINTR)
+				;
+			continue;
+		}
+
+		ret = frames_get(self, slot, 1);
+		if (ret < 0) {
+			__atomic_store_n(
+				&self->prefetch_err, (int)ret, __ATOMIC_RELEASE);
+			break;
+		} else if (ret == 0) {
+			__atomic_store_n(&self->eof, 1, __ATOMIC_RELEASE);
+			break;
+		}
+		araw_ring_push_commit(&self->ring, self->frame_size);
+	}
+
+	return NULL;
+}
+
+
+static int reader_prefetch_start(struct araw_reader *self)
+{
+	int ret;
+
+	if (self->ring.buf == NULL) {
+		ret = araw_ring_init(&self->ring,
+				     self->cfg.prefetch_depth,
+				     self->frame_size);
+		if (ret < 0) {
+			ULOG_ERRNO("araw_ring_init", -ret);
+			return ret;
+		}
+	}
+
+	if (!self->sem_created) {
+		ret = sem_init(&self->sem, 0, 0);
+		if (ret < 0) {
+			ret = -errno;
+			ULOG_ERRNO("sem_init", -ret);
+			return ret;
+		}
+		self->sem_created = true;
+	}
+
+	self->stop = 0;
+	self->eof = 0;
+	self->prefetch_err = 0;
+	ret = pthread_create(&self->thread, NULL, reader_thread, self);
+	if (ret != 0) {
+		ULOG_ERRNO("pthread_create", ret);
+		return -ret;
+	}
+	self->thread_launched = true;
+
+	return 0;
+}
+
+
+static void reader_prefetch_stop(struct araw_reader *self)
+{
+	if (!self->thread_launched)
+		return;
+
+	__atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+	sem_post(&self->sem);
+	pthread_join(self->thread, NULL);
+	self->thread_launched = false;
+
+	/* Drop the frames read ahead */
+	araw_ring_reset(&self->ring);
+	while (sem_trywait(&self->sem) == 0)
+		;
+}
+
+
+/* Get the next frame read ahead; returns -EAGAIN if no frame is available
+ * yet and -ENOENT at end of file */
+static int reader_prefetch_pop(struct araw_reader *self, uint8_t *data)
+{
+	int ret;
+	const uint8_t *slot;
+
+	slot = araw_ring_pop_get(&self->ring, NULL);
+	if (slot == NULL) {
+		ret = __atomic_load_n(&self->prefetch_err, __ATOMIC_ACQUIRE);
+		if (ret < 0)
+			return ret;
+		if (!__atomic_load_n(&self->eof, __ATOMIC_ACQUIRE))
+			return -EAGAIN;
+		/* The last frame may have been pushed before the end of file
+		 * was flagged */
+		slot = araw_ring_pop_get(&self->ring, NULL);
+		if (slot == NULL)
+			return -ENOENT;
+	}
+
+	memcpy(data, slot, self->frame_size);
+	araw_ring_pop_commit(&self->ring);
+	sem_post(&self->sem);
+
+	return 0;
+}
+
+
+static int reader_convert_init(struct araw_reader *self)
+{
+	int ret;
+	enum araw_sample_format file_sample_format = self->file_sample_format;
+
+	if (self->cfg.sample_format == ARAW_SAMPLE_FORMAT_UNKNOWN) {
+		/* Output the file samples unchanged */
+		self->cfg.sample_format = file_sample_format;
+		self->conv.identity = true;
+		self->conv.src_size = self->cfg.format.bit_depth / 8;
+		self->conv.dst_size = self->conv.src_size;
+		return 0;
+	}
+
+	ret = araw_convert_init(&self->conv,
+				file_sample_format,
+				self->cfg.format.pcm.little_endian,
+				self->cfg.sample_format,
+				ARAW_HOST_LE);
+	if (ret < 0) {
+		ULOG_ERRNO("araw_convert_init", -ret);
+		return ret;
+	}
+	if (self->conv.identity)
+		return 0;
+
+	/* Frames are given in the output format */
+	araw_sample_format_to_adef(self->cfg.sample_format, &self->cfg.format);
+
+	return 0;
+}
+
+
+static int reader_planar_init(struct araw_reader *self)
+{
+	int ret;
+
+	if (self->cfg.planar_align == 0)
+		self->cfg.planar_align = ARAW_CACHE_LINE_SIZE;
+	ULOG_ERRNO_RETURN_ERR_IF(
+		self->cfg.planar_align & (self->cfg.planar_align - 1), EINVAL);
+
+	ret = araw_planar_init(&self->planar,
+			       self->cfg.format.channel_count,
+			       self->conv.dst_size);
+	if (ret < 0) {
+		ULOG_ERRNO("araw_planar_init", -ret);
+		return ret;
+	}
+
+	self->plane_stride = self->cfg.frame_length * self->conv.dst_size;
+	self->plane_stride = (self->plane_stride + self->cfg.planar_align - 1) &
+			     ~(size_t)(self->cfg.planar_align - 1);
+	self->cfg.format.pcm.interleaved = false;
+
+	if (!self->conv.identity) {
+		self->interleaved = malloc(self->cfg.frame_length *
+					   self->cfg.format.channel_count *
+					   self->conv.dst_size);
+		if (self->interleaved == NULL)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+
+/* Get the WAVE header from the header cache; returns -ENOENT if the file
+ * is not in the cache */
+static int header_cache_load(struct araw_reader *self)
+{
+	int ret;
+	struct araw_header_info info;
+
+	ret = araw_header_cache_get(self->filename, &self->st, &info);
+	if (ret < 0)
+		return ret;
+
+	self->header = info.header;
+	self->fmt_ext = info.fmt_ext;
+	self->chunks = info.chunks;
+	self->chunk_count = info.chunk_count;
+	ret = wave_fmt_parse(self);
+	if (ret < 0)
+		return ret;
+
+	ret = araw_io_seek(&self->io, info.data_offset, SEEK_SET);
+	if (ret < 0) {
+		ULOG_ERRNO("seek", -ret);
+		return ret;
+	}
+	self->data_offset = info.data_offset;
+	self->data_size = info.data_size;
+	self->data_length = self->data_size;
+	self->cfg.data_length = self->data_length;
+
+	return 0;
+}
+
+
+static void header_cache_store(struct araw_reader *self)
+{
+	struct araw_header_info info = {
+		.header = self->header,
+		.fmt_ext = self->fmt_ext,
+		.data_offset = self->data_offset,
+		.data_size = self->data_size,
+		.chunks = self->chunks,
+		.chunk_count = self->chunk_count,
+	};
+
+	araw_header_cache_put(self->filename, &self->st, &info);
+}
+
+
+static int reader_pool_init(struct araw_reader *self)
+{
+	int ret;
+	size_t align = ARAW_CACHE_LINE_SIZE;
+
+	if (self->cfg.planar && self->cfg.planar_align > align)
+		align = self->cfg.planar_align;
+	self->pool_stride = (self->frame_size + align - 1) & ~(align - 1);
+	ULOG_ERRNO_RETURN_ERR_IF(self->pool_stride >
+					 SIZE_MAX / self->cfg.pool_size,
+				 EINVAL);
+
+	ret = posix_memalign((void **)&self->pool,
+			     align,
+			     self->cfg.pool_size * self->pool_stride);
+	if (ret != 0) {
+		self->pool = NULL;
+		return -ret;
+	}
+	self->pool_refs =
+		calloc(self->cfg.pool_size, sizeof(*self->pool_refs));
+	if (self->pool_refs == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+
+/* Take a free buffer of the frame pool (NULL if none) */
+static uint8_t *pool_get(struct araw_reader *self)
+{
+	unsigned int i, idx, expected;
+
+	for (i = 0; i < self->cfg.pool_size; i++) {
+		idx = (self->pool_next + i) % self->cfg.pool_size;
+		expected = 0;
+		if (__atomic_compare_exchange_n(&self->pool_refs[idx],
+						&expected,
+						1,
+						false,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED)) {
+			self->pool_next = idx + 1;
+			return self->pool + idx * self->pool_stride;
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Reference count of the pool buffer holding data (NULL if data is not a
+ * pool buffer) */
+static unsigned int *pool_refs_get(struct araw_reader *self,
+				   const uint8_t *data)
+{
+	size_t offset;
+
+	if (self->pool == NULL || data < self->pool ||
+	    data >= self->pool + self->cfg.pool_size * self->pool_stride)
+		return NULL;
+	offset = data - self->pool;
+	if (offset % self->pool_stride != 0)
+		return NULL;
+	return &self->pool_refs[offset / self->pool_stride];
+}
+
+
+/* Loop mode: load the PCM data in memory */
+static int reader_loop_init(struct araw_reader *self)
+{
+	ssize_t n;
+	size_t len;
+	uint8_t *buf = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self->data_size == 0, EINVAL);
+	/* Raw stream of unknown length */
+	ULOG_ERRNO_RETURN_ERR_IF(self->data_size == UINT64_MAX, EINVAL);
+
+	if (self->io.mem != NULL) {
+		/* Already in memory */
+		ULOG_ERRNO_RETURN_ERR_IF(
+			(uint64_t)self->data_offset > self->io.mem_len, EPROTO);
+		len = self->io.mem_len - self->data_offset;
+		if (len > self->data_size)
+			len = self->data_size;
+	} else {
+		ULOG_ERRNO_RETURN_ERR_IF(self->data_size > SIZE_MAX, ENOMEM);
+		buf = malloc(self->data_size);
+		if (buf == NULL)
+			return -ENOMEM;
+		n = araw_io_read(&self->io, buf, self->data_size);
+		if (n < 0) {
+			free(buf);
+			ULOG_ERRNO("read", (int)-n);
+			return n;
+		}
+		len = n;
+	}
+
+	/* Only loop over complete samples */
+	len -= len % self->sample_size;
+	if (len == 0) {
+		free(buf);
+		ULOGE("'%s': no complete sample to loop over", self->filename);
+		return -EIO;
+	}
+	self->data_size = len;
+	self->data_length = len;
+	if (buf == NULL)
+		return 0;
+
+	/* Read the data from memory from now on */
+	araw_io_close(&self->io);
+	araw_io_init_mem(&self->io, buf, len, len);
+	self->loop_buf = buf;
+	self->data_offset = 0;
+
+	return 0;
+}
+
+
+static uint64_t pace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Paced mode: due time of a frame, from the number of frames read before
+ * it */
+static uint64_t pace_due_time(struct araw_reader *self, uint64_t count)
+{
+	double samples = (double)count * self->cfg.frame_length;
+
+	return self->pace_start +
+	       (uint64_t)(samples * 1e9 / self->cfg.format.sample_rate /
+			  self->cfg.speed);
+}
+
+
+static int reader_pace_init(struct araw_reader *self)
+{
+#ifdef __linux__
+	int ret;
+	struct itimerspec its;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self->cfg.speed < 0.f, EINVAL);
+	if (self->cfg.speed == 0.f)
+		self->cfg.speed = 1.f;
+
+	self->pace_fd =
+		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (self->pace_fd < 0) {
+		ret = -errno;
+		ULOG_ERRNO("timerfd_create", -ret);
+		return ret;
+	}
+
+	/* The first frame is due as soon as it is read */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_nsec = 1;
+	ret = timerfd_settime(self->pace_fd, 0, &its, NULL);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("timerfd_settime", -ret);
+		return ret;
+	}
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+
+/* Paced mode: number of frames due now, at most count */
+static unsigned int reader_pace_due(struct araw_reader *self,
+				    unsigned int count)
+{
+	unsigned int n = 0;
+	uint64_t now;
+
+	if (self->pace_fd < 0)
+		return count;
+
+	now = pace_now();
+	if (!self->pace_started) {
+		self->pace_start = now;
+		self->pace_started = true;
+	}
+	while (n < count && pace_due_time(self, self->pace_count + n) <= now)
+		n++;
+
+	return n;
+}
+
+
+/* Paced mode: account for the frames read, and arm the timer for the next
+ * one */
+static void reader_pace_commit(struct araw_reader *self, unsigned int count)
+{
+#ifdef __linux__
+	struct itimerspec its;
+	uint64_t due;
+
+	if (self->pace_fd < 0 || count == 0)
+		return;
+
+	self->pace_count += count;
+	due = pace_due_time(self, self->pace_count);
+
+	/* Absolute time: an overdue frame is signaled at once */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = due / 1000000000;
+	its.it_value.tv_nsec = due % 1000000000;
+	if (timerfd_settime(self->pace_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		ULOG_ERRNO("timerfd_settime", errno);
+#endif
+}
+
+
+/* Read the header and set up the reader once the file is opened */
+static int reader_open(struct araw_reader *self)
+{
+	int ret;
+	int64_t pos;
+
+	/* The data offset is counted from the current position, which is
+	 * unknown on pipes */
+	pos = araw_io_tell(&self->io);
+	if (pos < 0 && pos != -ESPIPE) {
+		ULOG_ERRNO("tell", (int)-pos);
+		return pos;
+	}
+	self->data_offset = pos < 0 ? 0 : pos;
+
+	if (self->cfg.raw) {
+		ret = raw_header_init(self);
+		if (ret < 0)
+			return ret;
+	} else {
+		ret = -ENOENT;
+		if (self->st_valid)
+			ret = header_cache_load(self);
+		if (ret == -ENOENT) {
+			/* Read WAVE file header */
+			ret = wave_header_read(self);
+			if (ret < 0)
+				return ret;
+			if (self->st_valid)
+				header_cache_store(self);
+		} else if (ret < 0) {
+			return ret;
+		}
+	}
+
+	self->sample_size = self->cfg.format.channel_count *
+			    (self->cfg.format.bit_depth / 8);
+	self->file_frame_size = self->cfg.frame_length * self->sample_size;
+
+	if (self->cfg.mmap) {
+		ret = wave_map(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (self->cfg.loop) {
+		ret = reader_loop_init(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Positional reads fail on pipes and sockets */
+	self->pread_fd = araw_io_pread_fd(&self->io);
+	if (self->pread_fd >= 0 && lseek(self->pread_fd, 0, SEEK_CUR) < 0)
+		self->pread_fd = -1;
+
+	if (self->cfg.paced) {
+		ret = reader_pace_init(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = reader_convert_init(self);
+	if (ret < 0)
+		return ret;
+
+	self->frame_size = self->cfg.frame_length *
+			   self->cfg.format.channel_count *
+			   self->conv.dst_size;
+
+	if (self->cfg.planar) {
+		ret = reader_planar_init(self);
+		if (ret < 0)
+			return ret;
+		self->frame_size =
+			self->cfg.format.channel_count * self->plane_stride;
+	}
+
+	self->zero_copy = self->conv.identity && !self->cfg.planar;
+	if (!self->zero_copy && !self->cfg.mmap) {
+		self->scratch = malloc(self->file_frame_size);
+		if (self->scratch == NULL)
+			return -ENOMEM;
+	}
+
+	if (self->cfg.pool_size > 0) {
+		ret = reader_pool_init(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (self->cfg.prefetch_depth > 0) {
+		ret = reader_prefetch_start(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+
+static int reader_alloc(const char *name,
+			const struct araw_reader_config *config,
+			struct araw_reader **ret_obj)
+{
+	struct araw_reader *self;
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+
+	self->cfg = *config;
+	self->pace_fd = -1;
+
+	if (self->cfg.frame_length == 0)
+		self->cfg.frame_length = DEFAULT_FRAME_LENGTH;
+	if (self->cfg.timescale == 0)
+		self->cfg.timescale = DEFAULT_TIMESCALE;
+
+	self->filename = strdup(name);
+	if (self->filename == NULL) {
+		free(self);
+		return -ENOMEM;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+
+int araw_reader_new(const char *filename,
+		    const struct araw_reader_config *config,
+		    struct araw_reader **ret_obj)
+{
+	int ret = 0, fd;
+	struct araw_reader *self = NULL;
+	FILE *file;
+
+	ULOG_ERRNO_RETURN_ERR_IF(filename == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap && config->prefetch_depth > 0,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap && config->uring, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap && config->loop, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = reader_alloc(filename, config, &self);
+	if (ret < 0)
+		return ret;
+
+	if (self->cfg.uring) {
+		fd = open(self->filename, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			ret = -errno;
+			ULOG_ERRNO("open('%s')", -ret, self->filename);
+			goto error;
+		}
+		ret = araw_io_init_uring(&self->io, fd);
+		if (ret < 0) {
+			ULOG_ERRNO("araw_io_init_uring", -ret);
+			close(fd);
+			goto error;
+		}
+	} else {
+		file = fopen(self->filename, "rb");
+		if (file == NULL) {
+			ret = -errno;
+			ULOG_ERRNO("fopen('%s')", -ret, self->filename);
+			goto error;
+		}
+		araw_io_init_file(&self->io, file);
+		fd = fileno(file);
+	}
+
+	if (self->cfg.header_cache && !self->cfg.raw) {
+		/* Cache key */
+		if (fstat(fd, &self->st) == 0 && S_ISREG(self->st.st_mode))
+			self->st_valid = true;
+	}
+
+	ret = reader_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+
+	return 0;
+
+error:
+	(void)araw_reader_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_reader_new_from_fd(int fd,
+			    const struct araw_reader_config *config,
+			    struct araw_reader **ret_obj)
+{
+	int ret = 0, dup_fd;
+	struct araw_reader *self = NULL;
+	char name[32];
+	FILE *file;
+
+	ULOG_ERRNO_RETURN_ERR_IF(fd < 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap && config->prefetch_depth > 0,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap && config->loop, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	snprintf(name, sizeof(name), "fd %d", fd);
+	ret = reader_alloc(name, config, &self);
+	if (ret < 0)
+		return ret;
+
+	/* The caller keeps the ownership of the file descriptor */
+	dup_fd = dup(fd);
+	if (dup_fd < 0) {
+		ret = -errno;
+		ULOG_ERRNO("dup", -ret);
+		goto error;
+	}
+
+	file = fdopen(dup_fd, "rb");
+	if (file == NULL) {
+		ret = -errno;
+		ULOG_ERRNO("fdopen", -ret);
+		close(dup_fd);
+		goto error;
+	}
+	araw_io_init_file(&self->io, file);
+
+	ret = reader_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+
+	return 0;
+
+error:
+	(void)araw_reader_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_reader_new_from_io(const struct araw_io_ops *ops,
+			    void *userdata,
+			    const struct araw_reader_config *config,
+			    struct araw_reader **ret_obj)
+{
+	int ret = 0;
+	struct araw_reader *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ops == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ops->read == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap, EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = reader_alloc("io", config, &self);
+	if (ret < 0)
+		return ret;
+
+	araw_io_init_ops(&self->io, ops, userdata);
+
+	ret = reader_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+
+	return 0;
+
+error:
+	(void)araw_reader_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_reader_new_segments(const char *const *filenames,
+			     unsigned int count,
+			     const struct araw_reader_config *config,
+			     struct araw_reader **ret_obj)
+{
+	int ret = 0;
+	struct araw_reader *self = NULL;
+	struct araw_segments *segments = NULL;
+	struct araw_reader_config seg_cfg;
+
+	ULOG_ERRNO_RETURN_ERR_IF(filenames == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->mmap, EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = araw_segments_new(filenames, count, &seg_cfg, &segments);
+	if (ret < 0)
+		return ret;
+
+	ret = reader_alloc(filenames[0], config, &self);
+	if (ret < 0) {
+		araw_segments_destroy(segments);
+		return ret;
+	}
+	self->segments = segments;
+
+	/* The data of the segments is read as a raw stream in the format of
+	 * the first segment */
+	self->cfg.raw = true;
+	self->cfg.raw_offset = 0;
+	self->cfg.format = seg_cfg.format;
+	self->cfg.wave_format = seg_cfg.wave_format;
+	self->cfg.data_length = araw_segments_size(segments);
+	araw_io_init_ops(&self->io, &araw_segments_ops, segments);
+
+	ret = reader_open(self);
+	if (ret < 0)
+		goto error;
+	self->cfg.channel_mask = seg_cfg.channel_mask;
+	self->cfg.valid_bits = seg_cfg.valid_bits;
+
+	*ret_obj = self;
+
+	return 0;
+
+error:
+	(void)araw_reader_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_reader_new_from_buffer(const uint8_t *data,
+				size_t len,
+				const struct araw_reader_config *config,
+				struct araw_reader **ret_obj)
+{
+	int ret = 0;
+	struct araw_reader *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->prefetch_depth > 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = reader_alloc("buffer", config, &self);
+	if (ret < 0)
+		return ret;
+
+	/* The region is never written by the reader; in loop mode, the
+	 * frames are copied from it to wrap around */
+	araw_io_init_mem(&self->io, (uint8_t *)data, len, len);
+	self->cfg.mmap = !config->loop;
+
+	ret = reader_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+
+	return 0;
+
+error:
+	(void)araw_reader_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_reader_destroy(struct araw_reader *self)
+{
+	unsigned int i, borrowed;
+
+	if (self == NULL)
+		return 0;
+
+	borrowed = self->borrowed;
+	for (i = 0; self->pool_refs != NULL && i < self->cfg.pool_size; i++)
+		borrowed += self->pool_refs[i] > 0;
+	if (borrowed > 0)
+		ULOGW("%u frame(s) still borrowed", borrowed);
+
+	reader_prefetch_stop(self);
+	if (self->sem_created)
+		sem_destroy(&self->sem);
+	araw_ring_clear(&self->ring);
+
+	if (self->map != NULL && self->io.mem == NULL)
+		munmap(self->map, self->map_size);
+
+	araw_io_close(&self->io);
+	araw_segments_destroy(self->segments);
+	if (self->pace_fd >= 0)
+		close(self->pace_fd);
+
+	free(self->loop_buf);
+	free(self->chunks);
+	free(self->pool);
+	free(self->pool_refs);
+	free(self->interleaved);
+	free(self->scratch);
+	free(self->filename);
+	free(self);
+	return 0;
+}
+
+
+int araw_reader_get_config(struct araw_reader *self,
+			   struct araw_reader_config *config)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+
+	*config = self->cfg;
+	return 0;
+}
+
+
+ssize_t araw_reader_get_min_buf_size(struct araw_reader *self)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+
+	return self->frame_size;
+}
+
+
+/* In planar mode, the planes must be aligned as configured */
+static inline bool buffer_is_aligned(struct araw_reader *self,
+				     const uint8_t *data)
+{
+	return !self->cfg.planar ||
+	       ((uintptr_t)data & (self->cfg.planar_align - 1)) == 0;
+}
+
+
+/* Timestamp of a sample in the reader timescale, rounded to nearest; it
+ * is computed from the sample index so that rounding errors do not
+ * accumulate */
+static uint64_t sample_to_timestamp(struct araw_reader *self, uint64_t sample)
+{
+	uint64_t rate = self->cfg.format.sample_rate;
+	uint64_t timescale = self->cfg.timescale;
+
+	/* Split to avoid overflowing sample * timescale */
+	return self->cfg.start_timestamp + (sample / rate) * timescale +
+	       ((sample % rate) * timescale + rate / 2) / rate;
+}
+
+
+/* First sample at or after a timestamp in the reader timescale */
+static uint64_t timestamp_to_sample(struct araw_reader *self, uint64_t ts)
+{
+	uint64_t rate = self->cfg.format.sample_rate;
+	uint64_t timescale = self->cfg.timescale;
+
+	ts -= self->cfg.start_timestamp;
+	return (ts / timescale) * rate +
+	       ((ts % timescale) * rate + timescale - 1) / timescale;
+}
+
+
+static void frame_info_fill(struct araw_reader *self, struct araw_frame *frame)
+{
+	frame->frame.format = self->cfg.format;
+	frame->frame.info.timestamp =
+		sample_to_timestamp(self, self->sample_index);
+	frame->frame.info.timescale = self->cfg.timescale;
+	frame->frame.info.index = self->index;
+
+	self->index++;
+	self->sample_index += self->cfg.frame_length;
+}
+
+
+int araw_reader_frame_read(struct araw_reader *self,
+			   uint8_t *data,
+			   size_t len,
+			   struct araw_frame *frame)
+{
+	int ret;
+	uint64_t start = araw_stats_now();
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len == 0, ENOBUFS);
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+
+	ULOG_ERRNO_RETURN_ERR_IF(len < self->frame_size, ENOBUFS);
+	ULOG_ERRNO_RETURN_ERR_IF(!buffer_is_aligned(self, data), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->io.ops == NULL, EPROTO);
+
+	if (reader_pace_due(self, 1) == 0)
+		return -EAGAIN;
+
+	if (self->cfg.prefetch_depth > 0) {
+		ret = reader_prefetch_pop(self, data);
+		if (ret < 0)
+			return ret;
+	} else {
+		/* Read the PCM data */
+		ret = frames_get(self, data, 1);
+		if (ret < 0) {
+			ULOG_ERRNO("frames_get", -ret);
+			return ret;
+		} else if (ret == 0) {
+			return -ENOENT;
+		}
+	}
+
+	/* Fill the frame info */
+	frame->data = data;
+	frame->cdata_length = self->frame_size;
+	frame_info_fill(self, frame);
+	reader_pace_commit(self, 1);
+	araw_stats_frames_add(&self->stats, 1, start);
+
+	return 0;
+}
+
+
+int araw_reader_frames_read(struct araw_reader *self,
+			    uint8_t *data,
+			    size_t len,
+			    struct araw_frame *frames,
+			    unsigned int count)
+{
+	ssize_t ret;
+	unsigned int i;
+	uint64_t start = araw_stats_now();
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frames == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len < self->frame_size, ENOBUFS);
+	ULOG_ERRNO_RETURN_ERR_IF(!buffer_is_aligned(self, data), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->io.ops == NULL, EPROTO);
+
+	/* Limit to the buffer size and to the remaining complete frames */
+	if (count > len / self->frame_size)
+		count = len / self->frame_size;
+
+	/* Paced mode: limit to the frames already due */
+	count = reader_pace_due(self, count);
+	if (count == 0)
+		return -EAGAIN;
+
+	if (self->cfg.prefetch_depth > 0) {
+		/* Take as many frames as already read ahead */
+		for (i = 0; i < count; i++) {
+			ret = reader_prefetch_pop(self,
+						  data + i * self->frame_size);
+			if (ret < 0)
+				break;
+		}
+		if (i == 0)
+			return ret;
+		count = i;
+		goto fill;
+	}
+
+	ret = frames_get(self, data, count);
+	if (ret < 0) {
+		ULOG_ERRNO("frames_get", -ret);
+		return ret;
+	} else if (ret == 0) {
+		return -ENOENT;
+	}
+	count = ret;
+
+fill:
+	for (i = 0; i < count; i++) {
+		frames[i].data = data + i * self->frame_size;
+		frames[i].cdata_length = self->frame_size;
+		frame_info_fill(self, &frames[i]);
+	}
+	reader_pace_commit(self, count);
+	araw_stats_frames_add(&self->stats, count, start);
+
+	return count;
+}
+
+
+/* Positional read of up to len bytes at pos in the file; returns the
+ * number of bytes read (less than len only at end of file) */
+static ssize_t
+file_pread(struct araw_reader *self, uint8_t *data, size_t len, uint64_t pos)
+{
+	ssize_t ret;
+	size_t n = 0;
+	const uint8_t *base;
+	uint64_t end;
+	int fd;
+
+	/* Mapped file or memory buffer */
+	base = self->map != NULL ? self->map : self->io.mem;
+	if (base != NULL) {
+		end = self->map != NULL ? self->map_size : self->io.mem_len;
+		if (pos >= end)
+			return 0;
+		if (len > end - pos)
+			len = end - pos;
+		memcpy(data, base + pos, len);
+		return len;
+	}
+
+	fd = self->pread_fd;
+	while (n < len) {
+		ret = pread(fd, data + n, len - n, (off_t)(pos + n));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			ULOG_ERRNO("pread", (int)-ret);
+			return n > 0 ? (ssize_t)n : ret;
+		} else if (ret == 0) {
+			break;
+		}
+		n += ret;
+	}
+
+	return n;
+}
+
+
+ssize_t araw_reader_read_range(struct araw_reader *self,
+			       uint64_t offset,
+			       size_t count,
+			       uint8_t *data,
+			       size_t len)
+{
+	ssize_t ret;
+	uint64_t total;
+	size_t out_sample_size, chunk, read_len, n, done = 0;
+	uint8_t *src = NULL, *interleaved, *ptr;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->io.ops == NULL, EPROTO);
+	ULOG_ERRNO_RETURN_ERR_IF(self->map == NULL && self->io.mem == NULL &&
+					 self->pread_fd < 0,
+				 EOPNOTSUPP);
+
+	out_sample_size = self->cfg.format.channel_count * self->conv.dst_size;
+	ULOG_ERRNO_RETURN_ERR_IF(count > len / out_sample_size, ENOBUFS);
+
+	total = self->data_size / self->sample_size;
+	if (offset >= total)
+		return -ENOENT;
+	if (count > total - offset) {
+		/* Planes stay count samples apart */
+		n = total - offset;
+	} else {
+		n = count;
+	}
+
+	if (self->zero_copy) {
+		/* Read straight into the buffer */
+		ret = file_pread(self,
+				 data,
+				 n * self->sample_size,
+				 self->data_offset + offset * self->sample_size);
+		if (ret < 0)
+			return ret;
+		return (size_t)ret / self->sample_size;
+	}
+
+	chunk = n < RANGE_CHUNK_LENGTH ? n : RANGE_CHUNK_LENGTH;
+	src = malloc(chunk * (self->sample_size + out_sample_size));
+	if (src == NULL)
+		return -ENOMEM;
+	interleaved = src + chunk * self->sample_size;
+
+	while (done < n) {
+		if (chunk > n - done)
+			chunk = n - done;
+		read_len = chunk * self->sample_size;
+		ret = file_pread(self,
+				 src,
+				 read_len,
+				 self->data_offset +
+					 (offset + done) * self->sample_size);
+		if (ret < 0) {
+			if (done == 0)
+				goto out;
+			break;
+		}
+		chunk = (size_t)ret / self->sample_size;
+		if (chunk == 0)
+			break;
+
+		if (!self->cfg.planar) {
+			araw_convert_run(&self->conv,
+					 data + done * out_sample_size,
+					 src,
+					 chunk * self->cfg.format.channel_count);
+		} else {
+			ptr = src;
+			if (!self->conv.identity) {
+				araw_convert_run(&self->conv,
+						 interleaved,
+						 src,
+						 chunk * self->cfg.format
+								 .channel_count);
+				ptr = interleaved;
+			}
+			self->planar.deinterleave(&self->planar,
+						  data + done * self->conv.dst_size,
+						  count * self->conv.dst_size,
+						  ptr,
+						  chunk);
+		}
+		done += chunk;
+		if ((size_t)ret < read_len)
+			break;
+	}
+	ret = done;
+
+out:
+	free(src);
+	return ret;
+}
+
+
+int araw_reader_get_chunks(struct araw_reader *self,
+			   const struct araw_chunk **chunks,
+			   unsigned int *count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(chunks == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	*chunks = self->chunks;
+	*count = self->chunk_count;
+
+	return 0;
+}
+
+
+int araw_reader_find_chunk(struct araw_reader *self,
+			   uint32_t id,
+			   const struct araw_chunk **chunk)
+{
+	unsigned int i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(chunk == NULL, EINVAL);
+
+	for (i = 0; i < self->chunk_count; i++) {
+		if (self->chunks[i].id == id) {
+			*chunk = &self->chunks[i];
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+
+ssize_t araw_reader_chunk_read(struct araw_reader *self,
+			       const struct araw_chunk *chunk,
+			       uint64_t offset,
+			       uint8_t *data,
+			       size_t len)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(chunk == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->io.ops == NULL, EPROTO);
+	ULOG_ERRNO_RETURN_ERR_IF(self->map == NULL && self->io.mem == NULL &&
+					 self->pread_fd < 0,
+				 EOPNOTSUPP);
+	/* Loop mode: only the PCM data was kept */
+	ULOG_ERRNO_RETURN_ERR_IF(self->loop_buf != NULL, EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(offset > chunk->size, EINVAL);
+
+	if (len > chunk->size - offset)
+		len = chunk->size - offset;
+	if (len == 0)
+		return 0;
+
+	return file_pread(self, data, len, chunk->offset + offset);
+}
+
+
+int araw_reader_get_fd(struct araw_reader *self)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->pace_fd < 0, EPROTO);
+
+	return self->pace_fd;
+}
+
+
+int araw_reader_get_stats(struct araw_reader *self,
+			  struct araw_reader_stats *stats)
+{
+#if ARAW_STATS_ENABLED
+	struct araw_stats_io io;
+	struct araw_stats_frames frames;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	araw_stats_read(&self->io.stats.seq, &io, sizeof(io));
+	araw_stats_read(&self->stats.seq, &frames, sizeof(frames));
+
+	memset(stats, 0, sizeof(*stats));
+	stats->bytes = io.bytes;
+	stats->frames = frames.frames;
+	stats->io_calls = io.calls;
+	stats->seeks = io.seeks;
+	stats->short_reads = io.short_count;
+	stats->frame_read = frames.latency;
+
+	return 0;
+#else
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	return -ENOTSUP;
+#endif
+}
+
+
+int araw_reader_seek(struct araw_reader *self,
+		     enum araw_seek_mode mode,
+		     uint64_t value)
+{
+	int ret;
+	uint64_t sample, offset;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->io.ops == NULL, EPROTO);
+
+	switch (mode) {
+	case ARAW_SEEK_MODE_FRAME:
+		ULOG_ERRNO_RETURN_ERR_IF(value > UINT64_MAX /
+							 self->cfg.frame_length,
+					 ERANGE);
+		sample = value * self->cfg.frame_length;
+		break;
+	case ARAW_SEEK_MODE_SAMPLE:
+		sample = value;
+		break;
+	case ARAW_SEEK_MODE_TIMESTAMP:
+		ULOG_ERRNO_RETURN_ERR_IF(value < self->cfg.start_timestamp,
+					 ERANGE);
+		ULOG_ERRNO_RETURN_ERR_IF((value - self->cfg.start_timestamp) /
+							 self->cfg.timescale >
+						 UINT64_MAX / self->cfg.format
+								      .sample_rate,
+					 ERANGE);
+		sample = timestamp_to_sample(self, value);
+		break;
+	default:
+		ULOGE("unsupported seek mode: %d", mode);
+		return -EINVAL;
+	}
+
+	/* Samples are aligned on the block size (all channels) */
+	ULOG_ERRNO_RETURN_ERR_IF(sample > self->data_size / self->sample_size,
+				 ERANGE);
+	offset = sample * self->sample_size;
+
+	/* Drop the frames read ahead from the previous position */
+	reader_prefetch_stop(self);
+
+	if (!self->cfg.mmap) {
+		ret = araw_io_seek(
+			&self->io, self->data_offset + offset, SEEK_SET);
+		if (ret < 0) {
+			ULOG_ERRNO("seek", -ret);
+			return ret;
+		}
+	}
+
+	self->data_length = self->data_size - offset;
+	self->index = sample / self->cfg.frame_length;
+	self->sample_index = sample;
+
+	if (self->cfg.prefetch_depth > 0) {
+		ret = reader_prefetch_start(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+
+int araw_reader_frame_borrow(struct araw_reader *self,
+			     struct araw_frame *frame)
+{
+	int ret;
+	const uint8_t *ptr;
+	uint8_t *buf;
+	uint64_t start = araw_stats_now();
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+
+	if (!self->cfg.mmap || !self->zero_copy) {
+		/* Samples cannot be converted in the read-only mapping */
+		ULOG_ERRNO_RETURN_ERR_IF(self->pool == NULL,
+					 self->cfg.mmap ? ENOTSUP : EPROTO);
+
+		/* Read into a pool buffer */
+		buf = pool_get(self);
+		if (buf == NULL)
+			return -ENOBUFS;
+		ret = araw_reader_frame_read(
+			self, buf, self->pool_stride, frame);
+		if (ret < 0)
+			__atomic_store_n(pool_refs_get(self, buf),
+					 0,
+					 __ATOMIC_RELEASE);
+		return ret;
+	}
+
+	if (reader_pace_due(self, 1) == 0)
+		return -EAGAIN;
+
+	ptr = wave_map_data(self, self->frame_size);
+	if (ptr == NULL)
+		return -ENOENT;
+
+	/* The mapping is read-only; the frame data must not be modified */
+	frame->data = (uint8_t *)ptr;
+	frame->cdata_length = self->frame_size;
+	frame_info_fill(self, frame);
+	reader_pace_commit(self, 1);
+	__atomic_add_fetch(&self->borrowed, 1, __ATOMIC_RELAXED);
+	araw_stats_frames_add(&self->stats, 1, start);
+
+	return 0;
+}
+
+
+/* Add a reference to a borrowed frame (refs > 0), or drop one
+ * (refs < 0) */
+static int frame_ref_update(struct araw_reader *self,
+			    const struct araw_frame *frame,
+			    int refs)
+{
+	unsigned int *count, cur;
+
+	count = pool_refs_get(self, frame->cdata);
+	if (count == NULL) {
+		/* Frame borrowed from the mapping */
+		ULOG_ERRNO_RETURN_ERR_IF(self->map == NULL || !self->zero_copy,
+					 EINVAL);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			frame->cdata < self->map ||
+				frame->cdata >= self->map + self->map_size,
+			EINVAL);
+		count = &self->borrowed;
+	}
+
+	cur = __atomic_load_n(count, __ATOMIC_RELAXED);
+	do {
+		ULOG_ERRNO_RETURN_ERR_IF(cur == 0, EPROTO);
+	} while (!__atomic_compare_exchange_n(count,
+					      &cur,
+					      cur + refs,
+					      true,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+
+	return 0;
+}
+
+
+int araw_reader_frame_ref(struct araw_reader *self,
+			  const struct araw_frame *frame)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+
+	return frame_ref_update(self, frame, 1);
+}
+
+
+int araw_reader_frame_release(struct araw_reader *self,
+			      struct araw_frame *frame)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+
+	ret = frame_ref_update(self, frame, -1);
+	if (ret < 0)
+		return ret;
+
+	frame->cdata = NULL;
+	frame->cdata_length = 0;
 
 	return 0;
 }
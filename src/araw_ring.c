@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+
+int araw_ring_init(struct araw_ring *ring, unsigned int count, size_t slot_size)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ring == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(slot_size == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(slot_size > SIZE_MAX / count, EINVAL);
+
+	memset(ring, 0, sizeof(*ring));
+
+	/* Keep every slot aligned on a cache line */
+	slot_size = (slot_size + ARAW_CACHE_LINE_SIZE - 1) &
+		    ~(size_t)(ARAW_CACHE_LINE_SIZE - 1);
+
+	ret = posix_memalign(
+		(void **)&ring->buf, ARAW_CACHE_LINE_SIZE, count * slot_size);
+	if (ret != 0) {
+		ring->buf = NULL;
+		return -ret;
+	}
+
+	ring->lengths = calloc(count, sizeof(*ring->lengths));
+	if (ring->lengths == NULL) {
+		free(ring->buf);
+		ring->buf = NULL;
+		return -ENOMEM;
+	}
+
+	ring->count = count;
+	ring->slot_size = slot_size;
+
+	return 0;
+}
+
+
+void araw_ring_clear(struct araw_ring *ring)
+{
+	if (ring == NULL)
+		return;
+
+	free(ring->buf);
+	free(ring->lengths);
+	memset(ring, 0, sizeof(*ring));
+}
+
+
+void araw_ring_reset(struct araw_ring *ring)
+{
+	__atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->tail, 0, __ATOMIC_RELEASE);
+}
+
+
+unsigned int araw_ring_level(struct araw_ring *ring)
+{
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	return head - tail;
+}
+
+
+uint8_t *araw_ring_push_get(struct araw_ring *ring)
+{
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= ring->count)
+		return NULL;
+
+	return ring->buf + (size_t)(head % ring->count) * ring->slot_size;
+}
+
+
+void araw_ring_push_commit(struct araw_ring *ring, size_t len)
+{
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+	ring->lengths[head % ring->count] = len;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+uint8_t *araw_ring_pop_get(struct araw_ring *ring, size_t *len)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return NULL;
+
+	if (len != NULL)
+		*len = ring->lengths[tail % ring->count];
+	return ring->buf + (size_t)(tail % ring->count) * ring->slot_size;
+}
+
+
+void araw_ring_pop_commit(struct araw_ring *ring)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+uint8_t *araw_ring_peek(struct araw_ring *ring,
+			unsigned int index,
+			size_t *len)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head - tail <= index)
+		return NULL;
+
+	tail += index;
+	if (len != NULL)
+		*len = ring->lengths[tail % ring->count];
+	return ring->buf + (size_t)(tail % ring->count) * ring->slot_size;
+}
+
+
+void araw_ring_pop_commit_count(struct araw_ring *ring, unsigned int count)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+}
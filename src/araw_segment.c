@@ -0,0 +1,303 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+
+struct araw_segment {
+	char *filename;
+	/* Data chunk in the file */
+	uint64_t offset;
+	uint64_t size;
+	/* Position of the data in the stream */
+	uint64_t start;
+};
+
+
+/* Data of the segments read as a single stream */
+struct araw_segments {
+	struct araw_segment *segments;
+	unsigned int count;
+	uint64_t size;
+	/* Position in the stream */
+	uint64_t pos;
+	/* Segment currently opened, positioned at pos unless moved */
+	unsigned int current;
+	FILE *file;
+	bool moved;
+};
+
+
+char *araw_segment_name(const char *filename, unsigned int index)
+{
+	const char *base, *ext;
+	char *name;
+	size_t len, size;
+
+	/* The index goes before the extension (if any) of the base name */
+	base = strrchr(filename, '/');
+	base = base != NULL ? base + 1 : filename;
+	ext = strrchr(base, '.');
+	if (ext == NULL || ext == base)
+		ext = filename + strlen(filename);
+	len = ext - filename;
+
+	/* Room for a 10-digit index */
+	size = strlen(filename) + 12;
+	name = malloc(size);
+	if (name == NULL)
+		return NULL;
+	snprintf(name, size, "%.*s_%04u%s", (int)len, filename, index, ext);
+	return name;
+}
+
+
+static ssize_t segments_read(void *userdata, void *buf, size_t len)
+{
+	struct araw_segments *self = userdata;
+	struct araw_segment *seg;
+	size_t n, total = 0;
+
+	while (len > 0 && self->pos < self->size) {
+		/* Segment holding the current position */
+		while (self->pos >= self->segments[self->current].start +
+					    self->segments[self->current].size) {
+			self->current++;
+			self->moved = true;
+			if (self->file != NULL) {
+				fclose(self->file);
+				self->file = NULL;
+			}
+		}
+		seg = &self->segments[self->current];
+
+		if (self->file == NULL) {
+			self->file = fopen(seg->filename, "rb");
+			if (self->file == NULL) {
+				ULOG_ERRNO("fopen('%s')", errno, seg->filename);
+				return total > 0 ? (ssize_t)total : -errno;
+			}
+			self->moved = true;
+		}
+		if (self->moved) {
+			if (fseeko(self->file,
+				   (off_t)(seg->offset + self->pos -
+					   seg->start),
+				   SEEK_SET) < 0)
+				return total > 0 ? (ssize_t)total : -errno;
+			self->moved = false;
+		}
+
+		n = seg->start + seg->size - self->pos;
+		if (n > len)
+			n = len;
+		n = fread(buf, 1, n, self->file);
+		if (n == 0) {
+			ULOGE("'%s': truncated segment", seg->filename);
+			return total > 0 ? (ssize_t)total : -EIO;
+		}
+		buf = (uint8_t *)buf + n;
+		len -= n;
+		total += n;
+		self->pos += n;
+	}
+
+	return total;
+}
+
+
+static int segments_seek(void *userdata, int64_t offset, int whence)
+{
+	struct araw_segments *self = userdata;
+	int64_t pos;
+	unsigned int current;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (int64_t)self->pos + offset;
+		break;
+	case SEEK_END:
+		pos = (int64_t)self->size + offset;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (pos < 0)
+		return -EINVAL;
+
+	/* Find the segment (or the last one past the end) */
+	current = 0;
+	while (current + 1 < self->count &&
+	       (uint64_t)pos >= self->segments[current + 1].start)
+		current++;
+	if (current != self->current && self->file != NULL) {
+		fclose(self->file);
+		self->file = NULL;
+	}
+	self->current = current;
+	self->pos = pos;
+	self->moved = true;
+
+	return 0;
+}
+
+
+static int64_t segments_tell(void *userdata)
+{
+	struct araw_segments *self = userdata;
+
+	return self->pos;
+}
+
+
+const struct araw_io_ops araw_segments_ops = {
+	.read = segments_read,
+	.seek = segments_seek,
+	.tell = segments_tell,
+};
+
+
+/* Get the data chunk of a segment and check its format */
+static int segment_probe(struct araw_segment *seg,
+			 struct araw_reader_config *config,
+			 bool first)
+{
+	int ret;
+	struct araw_reader *reader;
+	struct araw_reader_config cfg;
+	const struct araw_chunk *chunk;
+
+	memset(&cfg, 0, sizeof(cfg));
+	ret = araw_reader_new(seg->filename, &cfg, &reader);
+	if (ret < 0)
+		return ret;
+
+	ret = araw_reader_get_config(reader, &cfg);
+	if (ret < 0)
+		goto out;
+	ret = araw_reader_find_chunk(
+		reader, ARAW_FOURCC('d', 'a', 't', 'a'), &chunk);
+	if (ret < 0)
+		goto out;
+	seg->offset = chunk->offset;
+	seg->size = cfg.data_length;
+
+	if (first) {
+		*config = cfg;
+	} else if (!adef_format_cmp(&cfg.format, &config->format) ||
+		   cfg.wave_format != config->wave_format ||
+		   cfg.channel_mask != config->channel_mask ||
+		   cfg.valid_bits != config->valid_bits) {
+		ULOGE("'%s': format differs from the first segment",
+		      seg->filename);
+		ret = -EINVAL;
+	}
+
+out:
+	araw_reader_destroy(reader);
+	return ret;
+}
+
+
+int araw_segments_new(const char *const *filenames,
+		      unsigned int count,
+		      struct araw_reader_config *config,
+		      struct araw_segments **ret_obj)
+{
+	int ret;
+	unsigned int i;
+	struct araw_segments *self;
+	struct araw_segment *seg;
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+
+	self->segments = calloc(count, sizeof(*self->segments));
+	if (self->segments == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	for (i = 0; i < count; i++) {
+		seg = &self->segments[i];
+		seg->filename = strdup(filenames[i]);
+		if (seg->filename == NULL) {
+			ret = -ENOMEM;
+			goto error;
+		}
+		self->count++;
+
+		ret = segment_probe(seg, config, i == 0);
+		if (ret < 0) {
+			ULOG_ERRNO("segment_probe('%s')", -ret, seg->filename);
+			goto error;
+		}
+		seg->start = self->size;
+		self->size += seg->size;
+	}
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	araw_segments_destroy(self);
+	return ret;
+}
+
+
+void araw_segments_destroy(struct araw_segments *self)
+{
+	unsigned int i;
+
+	if (self == NULL)
+		return;
+
+	if (self->file != NULL)
+		fclose(self->file);
+	for (i = 0; i < self->count; i++)
+		free(self->segments[i].filename);
+	free(self->segments);
+	free(self);
+}
+
+
+uint64_t araw_segments_size(struct araw_segments *self)
+{
+	return self->size;
+}
@@ -0,0 +1,584 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef BUILD_LIBURING
+#	include <liburing.h>
+#endif
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+
+/* Number of entries of the shared submission queue */
+#define URING_QUEUE_DEPTH 256
+
+/* Number of blocks in flight per file, and block size */
+#define URING_FILE_DEPTH 4
+#define URING_BLOCK_SIZE (32 * 1024)
+
+
+/* Read or write operation */
+struct uring_req {
+	/* Set once completed, with the result (number of bytes or negative
+	 * errno value) */
+	int done;
+	int res;
+};
+
+
+/* Ring shared by all the files of the process */
+struct araw_uring {
+#ifdef BUILD_LIBURING
+	struct io_uring ring;
+#endif
+	/* Whether the ring is usable (otherwise the operations are done
+	 * synchronously using pread()/pwrite()) */
+	bool ready;
+	unsigned int refcount;
+
+	/* Protects the submission queue and the fields below */
+	pthread_mutex_t mutex;
+	/* A single thread at a time reaps the completions for all the
+	 * waiting threads */
+	pthread_cond_t cond;
+	bool reaping;
+};
+
+
+struct uring_block {
+	struct uring_req req;
+	uint8_t *buf;
+	/* Position in the file and length of the operation */
+	uint64_t offset;
+	size_t len;
+	/* Number of bytes already consumed (reads) */
+	size_t pos;
+};
+
+
+/* File backend: sequential reads are served from blocks read ahead, writes
+ * are aggregated into blocks written asynchronously */
+struct araw_uring_file {
+	struct araw_uring *uring;
+	int fd;
+	uint8_t *buf;
+	struct uring_block blocks[URING_FILE_DEPTH];
+	/* Blocks in flight, in file order */
+	unsigned int first;
+	unsigned int count;
+	/* Whether the blocks in flight are writes */
+	bool writing;
+	/* Bytes in the next block to write */
+	size_t fill_len;
+	/* Current position */
+	uint64_t pos;
+	/* Position of the next block to read ahead */
+	uint64_t next;
+	bool eof;
+	/* Error of a completed write, reported by the next call */
+	int err;
+};
+
+
+static pthread_mutex_t uring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct araw_uring *uring_shared;
+
+
+static struct araw_uring *uring_get(void)
+{
+	struct araw_uring *uring;
+
+	pthread_mutex_lock(&uring_mutex);
+	uring = uring_shared;
+	if (uring != NULL) {
+		uring->refcount++;
+		goto out;
+	}
+
+	uring = calloc(1, sizeof(*uring));
+	if (uring == NULL)
+		goto out;
+	pthread_mutex_init(&uring->mutex, NULL);
+	pthread_cond_init(&uring->cond, NULL);
+	uring->refcount = 1;
+#ifdef BUILD_LIBURING
+	int ret = io_uring_queue_init(URING_QUEUE_DEPTH, &uring->ring, 0);
+	if (ret < 0)
+		ULOG_ERRNO("io_uring_queue_init", -ret);
+	else
+		uring->ready = true;
+#endif
+	if (!uring->ready)
+		ULOGI("io_uring not available, using pread/pwrite");
+	uring_shared = uring;
+
+out:
+	pthread_mutex_unlock(&uring_mutex);
+	return uring;
+}
+
+
+static void uring_put(struct araw_uring *uring)
+{
+	pthread_mutex_lock(&uring_mutex);
+	if (--uring->refcount > 0) {
+		pthread_mutex_unlock(&uring_mutex);
+		return;
+	}
+	uring_shared = NULL;
+	pthread_mutex_unlock(&uring_mutex);
+
+#ifdef BUILD_LIBURING
+	if (uring->ready)
+		io_uring_queue_exit(&uring->ring);
+#endif
+	pthread_cond_destroy(&uring->cond);
+	pthread_mutex_destroy(&uring->mutex);
+	free(uring);
+}
+
+
+static void uring_submit(struct araw_uring *uring,
+			 struct uring_req *req,
+			 bool write,
+			 int fd,
+			 void *buf,
+			 size_t len,
+			 uint64_t offset)
+{
+	ssize_t ret;
+
+	req->done = 0;
+	req->res = 0;
+
+#ifdef BUILD_LIBURING
+	if (uring->ready) {
+		struct io_uring_sqe *sqe;
+
+		pthread_mutex_lock(&uring->mutex);
+		sqe = io_uring_get_sqe(&uring->ring);
+		if (sqe == NULL) {
+			/* Queue full: submit the pending entries first */
+			(void)io_uring_submit(&uring->ring);
+			sqe = io_uring_get_sqe(&uring->ring);
+		}
+		if (sqe != NULL) {
+			if (write)
+				io_uring_prep_write(sqe, fd, buf, len, offset);
+			else
+				io_uring_prep_read(sqe, fd, buf, len, offset);
+			io_uring_sqe_set_data(sqe, req);
+			ret = io_uring_submit(&uring->ring);
+			if (ret <= 0) {
+				/* The entry stays queued: turn it into a no-op
+				 * without request, and do the operation
+				 * synchronously (nothing would submit it
+				 * before the wait) */
+				ULOG_ERRNO("io_uring_submit",
+					   ret < 0 ? (int)-ret : EAGAIN);
+				io_uring_prep_nop(sqe);
+				io_uring_sqe_set_data(sqe, NULL);
+				sqe = NULL;
+			}
+		}
+		pthread_mutex_unlock(&uring->mutex);
+		if (sqe != NULL)
+			return;
+	}
+#else
+	(void)uring;
+#endif
+
+	/* Synchronous fallback */
+	do {
+		ret = write ? pwrite(fd, buf, len, (off_t)offset)
+			    : pread(fd, buf, len, (off_t)offset);
+	} while (ret < 0 && errno == EINTR);
+	req->res = ret < 0 ? -errno : ret;
+	req->done = 1;
+}
+
+
+/* Wait for an operation to complete; returns its result */
+static int uring_wait(struct araw_uring *uring, struct uring_req *req)
+{
+#ifdef BUILD_LIBURING
+	int ret;
+	struct io_uring_cqe *cqe;
+	struct uring_req *done;
+
+	if (req->done)
+		return req->res;
+
+	pthread_mutex_lock(&uring->mutex);
+	while (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+		if (uring->reaping) {
+			pthread_cond_wait(&uring->cond, &uring->mutex);
+			continue;
+		}
+
+		/* Reap the completions of all the threads */
+		uring->reaping = true;
+		pthread_mutex_unlock(&uring->mutex);
+		ret = io_uring_wait_cqe(&uring->ring, &cqe);
+		while (ret == 0) {
+			/* No request for the entries whose submission
+			 * failed */
+			done = io_uring_cqe_get_data(cqe);
+			if (done != NULL) {
+				done->res = cqe->res;
+				__atomic_store_n(
+					&done->done, 1, __ATOMIC_RELEASE);
+			}
+			io_uring_cqe_seen(&uring->ring, cqe);
+			ret = io_uring_peek_cqe(&uring->ring, &cqe);
+		}
+		pthread_mutex_lock(&uring->mutex);
+		uring->reaping = false;
+		pthread_cond_broadcast(&uring->cond);
+		if (ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+			pthread_mutex_unlock(&uring->mutex);
+			ULOG_ERRNO("io_uring_wait_cqe", -ret);
+			return ret;
+		}
+	}
+	pthread_mutex_unlock(&uring->mutex);
+#else
+	(void)uring;
+#endif
+
+	return req->res;
+}
+
+
+/* Complete the oldest block in flight */
+static int file_complete(struct araw_uring_file *file)
+{
+	int ret;
+	ssize_t n;
+	struct uring_block *blk = &file->blocks[file->first];
+	size_t done;
+
+	ret = uring_wait(file->uring, &blk->req);
+	file->first = (file->first + 1) % URING_FILE_DEPTH;
+	file->count--;
+	if (!file->writing)
+		return ret;
+
+	/* Finish short writes synchronously */
+	for (done = ret < 0 ? blk->len : (size_t)ret; done < blk->len;
+	     done += n) {
+		n = pwrite(file->fd,
+			   blk->buf + done,
+			   blk->len - done,
+			   (off_t)(blk->offset + done));
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		} else if (n < 0) {
+			ret = -errno;
+			break;
+		} else if (n == 0) {
+			ret = -EIO;
+			break;
+		}
+	}
+
+	/* Keep the first write error for the next call */
+	if (ret < 0 && file->err == 0)
+		file->err = ret;
+
+	return ret < 0 ? ret : 0;
+}
+
+
+static void file_submit_fill(struct araw_uring_file *file)
+{
+	struct uring_block *blk =
+		&file->blocks[(file->first + file->count) % URING_FILE_DEPTH];
+
+	blk->offset = file->pos - file->fill_len;
+	blk->len = file->fill_len;
+	uring_submit(file->uring,
+		     &blk->req,
+		     true,
+		     file->fd,
+		     blk->buf,
+		     blk->len,
+		     blk->offset);
+	file->count++;
+	file->fill_len = 0;
+}
+
+
+/* Write the pending data and wait for all the blocks in flight; returns the
+ * first error */
+static int file_drain(struct araw_uring_file *file)
+{
+	int err;
+
+	if (file->fill_len > 0)
+		file_submit_fill(file);
+	while (file->count > 0)
+		(void)file_complete(file);
+	err = file->err;
+	file->writing = false;
+	file->err = 0;
+
+	return err;
+}
+
+
+static void file_read_ahead(struct araw_uring_file *file)
+{
+	struct uring_block *blk;
+
+	while (file->count < URING_FILE_DEPTH && !file->eof) {
+		blk = &file->blocks[(file->first + file->count) %
+				    URING_FILE_DEPTH];
+		blk->offset = file->next;
+		blk->len = URING_BLOCK_SIZE;
+		blk->pos = 0;
+		uring_submit(file->uring,
+			     &blk->req,
+			     false,
+			     file->fd,
+			     blk->buf,
+			     blk->len,
+			     blk->offset);
+		file->next += URING_BLOCK_SIZE;
+		file->count++;
+	}
+}
+
+
+static ssize_t uring_file_read(void *userdata, void *buf, size_t len)
+{
+	int ret;
+	struct araw_uring_file *file = userdata;
+	struct uring_block *blk;
+	size_t n;
+
+	if (file->writing) {
+		ret = file_drain(file);
+		if (ret < 0)
+			return ret;
+		file->next = file->pos;
+	}
+
+	file_read_ahead(file);
+	if (file->count == 0)
+		return 0;
+
+	blk = &file->blocks[file->first];
+	ret = uring_wait(file->uring, &blk->req);
+	if (ret < 0) {
+		(void)file_drain(file);
+		file->next = file->pos;
+		return ret;
+	}
+
+	n = (size_t)ret - blk->pos;
+	if (n > len)
+		n = len;
+	memcpy(buf, blk->buf + blk->pos, n);
+	blk->pos += n;
+	file->pos += n;
+
+	if (blk->pos == (size_t)ret) {
+		/* Block consumed; a short block is the end of file */
+		file->first = (file->first + 1) % URING_FILE_DEPTH;
+		file->count--;
+		if ((size_t)ret < blk->len) {
+			file->eof = true;
+			(void)file_drain(file);
+		}
+	}
+
+	return n;
+}
+
+
+static ssize_t uring_file_write(void *userdata, const void *buf, size_t len)
+{
+	int ret;
+	struct araw_uring_file *file = userdata;
+	struct uring_block *blk;
+	size_t n;
+
+	if (!file->writing) {
+		/* Drop the blocks read ahead */
+		(void)file_drain(file);
+		file->writing = true;
+	}
+
+	/* The next block is still in flight */
+	if (file->fill_len == 0 && file->count == URING_FILE_DEPTH)
+		(void)file_complete(file);
+
+	if (file->err < 0) {
+		ret = file->err;
+		file->err = 0;
+		return ret;
+	}
+
+	blk = &file->blocks[(file->first + file->count) % URING_FILE_DEPTH];
+	n = URING_BLOCK_SIZE - file->fill_len;
+	if (n > len)
+		n = len;
+	memcpy(blk->buf + file->fill_len, buf, n);
+	file->fill_len += n;
+	file->pos += n;
+
+	if (file->fill_len == URING_BLOCK_SIZE)
+		file_submit_fill(file);
+
+	return n;
+}
+
+
+static int uring_file_seek(void *userdata, int64_t offset, int whence)
+{
+	int ret;
+	struct araw_uring_file *file = userdata;
+	struct stat st;
+	int64_t pos;
+
+	ret = file_drain(file);
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = (int64_t)file->pos + offset;
+		break;
+	case SEEK_END:
+		if (fstat(file->fd, &st) < 0)
+			return -errno;
+		pos = st.st_size + offset;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (pos < 0)
+		return -EINVAL;
+
+	file->pos = pos;
+	file->next = pos;
+	file->eof = false;
+
+	return ret;
+}
+
+
+static int64_t uring_file_tell(void *userdata)
+{
+	struct araw_uring_file *file = userdata;
+
+	return file->pos;
+}
+
+
+static const struct araw_io_ops uring_file_ops = {
+	.read = uring_file_read,
+	.write = uring_file_write,
+	.seek = uring_file_seek,
+	.tell = uring_file_tell,
+};
+
+
+int araw_io_init_uring(struct araw_io *io, int fd)
+{
+	int ret;
+	unsigned int i;
+	struct araw_uring_file *file;
+
+	file = calloc(1, sizeof(*file));
+	if (file == NULL)
+		return -ENOMEM;
+	file->fd = fd;
+
+	ret = posix_memalign((void **)&file->buf,
+			     4096,
+			     URING_FILE_DEPTH * URING_BLOCK_SIZE);
+	if (ret != 0) {
+		free(file);
+		return -ret;
+	}
+	for (i = 0; i < URING_FILE_DEPTH; i++)
+		file->blocks[i].buf = file->buf + i * URING_BLOCK_SIZE;
+
+	file->uring = uring_get();
+	if (file->uring == NULL) {
+		free(file->buf);
+		free(file);
+		return -ENOMEM;
+	}
+
+	araw_io_init_ops(io, &uring_file_ops, file);
+	io->uring = file;
+
+	return 0;
+}
+
+
+int araw_io_uring_fd(struct araw_io *io)
+{
+	struct araw_uring_file *file = io->uring;
+
+	return file->fd;
+}
+
+
+int araw_io_close_uring(struct araw_io *io)
+{
+	int ret;
+	struct araw_uring_file *file = io->uring;
+
+	ret = file_drain(file);
+	if (ret < 0)
+		ULOG_ERRNO("write", -ret);
+	if (close(file->fd) < 0 && ret == 0) {
+		ret = -errno;
+		ULOG_ERRNO("close", -ret);
+	}
+	uring_put(file->uring);
+	free(file->buf);
+	free(file);
+
+	return ret;
+}
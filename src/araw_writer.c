@@ -24,68 +24,142 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "araw_priv.h"
 
 #define ULOG_TAG araw
 #include <ulog.h>
 
-#include <pthread.h>
-#define NB_SUPPORTED_FORMATS 24
-static struct adef_format supported_formats[NB_SUPPORTED_FORMATS];
-static pthread_once_t supported_formats_is_init = PTHREAD_ONCE_INIT;
-static void initialize_supported_formats(void)
-{
-	int i = 0;
-	supported_formats[i++] = adef_pcm_16b_8000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_8000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_11025hz_mono;
-	supported_formats[i++] = adef_pcm_16b_11025hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_12000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_12000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_16000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_16000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_22050hz_mono;
-	supported_formats[i++] = adef_pcm_16b_22050hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_24000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_24000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_32000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_32000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_44100hz_mono;
-	supported_formats[i++] = adef_pcm_16b_44100hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_48000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_48000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_64000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_64000hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_88200hz_mono;
-	supported_formats[i++] = adef_pcm_16b_88200hz_stereo;
-	supported_formats[i++] = adef_pcm_16b_96000hz_mono;
-	supported_formats[i++] = adef_pcm_16b_96000hz_stereo;
-}
-
 
 struct araw_writer {
 	char *filename;
-	FILE *file;
+	struct araw_io io;
 	struct araw_writer_config cfg;
 	struct wave_header header;
-	uint32_t data_length;
+	struct wave_fmt_ext fmt_ext;
+	size_t header_size;
+	/* Sample format in the file */
+	enum araw_sample_format file_sample_format;
+	uint64_t data_length;
+
+	/* Aggregation buffer, written at wbuf_pos in the file */
+	uint8_t *wbuf;
+	size_t wbuf_len;
+	uint64_t wbuf_pos;
+
+	/* Preallocated file size */
+	uint64_t prealloc_end;
+	/* Data length and time of the last header checkpoint */
+	uint64_t checkpoint_length;
+	struct timespec checkpoint_ts;
+
+	/* Sample conversion */
+	struct araw_convert conv;
+	uint8_t *scratch;
+	size_t scratch_size;
+	/* Frames given as several buffers, gathered for conversion */
+	uint8_t *gather;
+	size_t gather_size;
+
+	/* Planar input */
+	struct araw_planar planar;
+	uint8_t *interleaved;
+	size_t interleaved_size;
+
+	/* Asynchronous mode */
+	struct araw_ring ring;
+	pthread_t thread;
+	bool thread_launched;
+	sem_t sem;
+	bool sem_created;
+	int stop;
+	int async_err;
+	unsigned int overruns;
+	unsigned int queue_max;
+	/* Queue drained by the writer group scheduler thread */
+	bool group_attached;
+
+	/* Segmented mode: data size of a segment (0 if disabled), file name
+	 * the segment names derive from, and current segment index */
+	uint64_t segment_size;
+	char *segment_base;
+	unsigned int segment_index;
+
+	/* API calls statistics */
+	struct araw_stats_frames stats;
 };
 
 
-static int wave_header_write(struct araw_writer *self)
+/* The RIFF header is followed by a JUNK chunk reserving room for a ds64
+ * chunk, in case the file grows beyond 4 GiB and has to be turned into an
+ * RF64 file, then by the fmt chunk (with an optional extension) and the
+ * data chunk header */
+#define WAVE_RIFF_HEADER_SIZE offsetof(struct wave_header, subchunk1_id)
+#define WAVE_FMT_SIZE                                                          \
+	(offsetof(struct wave_header, subchunk2_id) -                          \
+	 offsetof(struct wave_header, subchunk1_id))
+#define WAVE_HEADER_MAX_SIZE                                                   \
+	(sizeof(struct wave_header) + sizeof(struct wave_chunk) +              \
+	 sizeof(struct wave_ds64) + sizeof(struct wave_fmt_ext))
+
+
+static void wave_header_init(struct araw_writer *self)
 {
-	int ret;
+	unsigned int format_tag;
+	size_t ext_size = 0;
+	bool is_float =
+		(self->file_sample_format == ARAW_SAMPLE_FORMAT_F32) ||
+		(self->file_sample_format == ARAW_SAMPLE_FORMAT_F64);
+	unsigned int bits = self->cfg.format.bit_depth;
+
+	format_tag = is_float ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+	if (is_float) {
+		/* Non-PCM formats have an (empty) extension */
+		ext_size = sizeof(self->fmt_ext.cb_size);
+	}
+
+	/* WAVE_FORMAT_EXTENSIBLE is required for more than 2 channels, more
+	 * than 16-bit integer samples, and to give the channel mask or the
+	 * valid bits */
+	if (self->cfg.format.channel_count > 2 || (!is_float && bits > 16) ||
+	    self->cfg.channel_mask != 0 ||
+	    (self->cfg.valid_bits != 0 && self->cfg.valid_bits != bits)) {
+		self->fmt_ext.cb_size =
+			sizeof(self->fmt_ext) - sizeof(self->fmt_ext.cb_size);
+		self->fmt_ext.valid_bits_per_sample =
+			self->cfg.valid_bits != 0 ? self->cfg.valid_bits : bits;
+		self->fmt_ext.channel_mask = self->cfg.channel_mask;
+		self->fmt_ext.sub_format = format_tag;
+		memcpy(self->fmt_ext.sub_format_suffix,
+		       araw_wave_subformat_suffix,
+		       WAVE_SUBFORMAT_SUFFIX_SIZE);
+		format_tag = WAVE_FORMAT_EXTENSIBLE;
+		ext_size = sizeof(self->fmt_ext);
+	}
+
+	self->header_size = WAVE_HEADER_MAX_SIZE - sizeof(self->fmt_ext) +
+			    ext_size;
 
 	self->header.chunk_id = FOURCC_RIFF;
 	self->header.chunk_size = 0; /* Fill this in on file-close */
 	self->header.format = FOURCC_WAVE;
 	self->header.subchunk1_id = FOURCC_fmt_;
-	self->header.subchunk1_size = 16; /* PCM */
-	self->header.audio_format = ADEF_WAVE_FORMAT_PCM;
+	self->header.subchunk1_size = WAVE_FMT_SIZE -
+				      sizeof(struct wave_chunk) + ext_size;
+	self->header.audio_format = format_tag;
 	self->header.num_channels = self->cfg.format.channel_count;
 	self->header.sample_rate = self->cfg.format.sample_rate;
 	self->header.byte_rate = self->cfg.format.sample_rate *
@@ -96,161 +170,1414 @@ static int wave_header_write(struct araw_writer *self)
 	self->header.bits_per_sample = 8 * (self->cfg.format.bit_depth / 8);
 	self->header.subchunk2_id = FOURCC_data;
 	self->header.subchunk2_size = 0; /* Fill this in on file-close */
+}
 
-	/* Write WAVE header */
-	ret = fwrite(&self->header, sizeof(self->header), 1, self->file);
-	if (ret < 0) {
-		ret = -errno;
-		ULOG_ERRNO("fwrite", -ret);
-		return ret;
+
+/* Serialize the header with the sizes matching the given data length */
+static void wave_header_fill(struct araw_writer *self,
+			     uint64_t data_length,
+			     uint8_t buf[WAVE_HEADER_MAX_SIZE])
+{
+	struct wave_chunk chunk = {
+		.id = FOURCC_JUNK,
+		.size = sizeof(struct wave_ds64),
+	};
+	struct wave_ds64 ds64;
+	uint64_t riff_size =
+		self->header_size - sizeof(struct wave_chunk) + data_length;
+	size_t ext_size = self->header.subchunk1_size + sizeof(struct wave_chunk) -
+			  WAVE_FMT_SIZE;
+	size_t off = 0;
+
+	memset(&ds64, 0, sizeof(ds64));
+
+	if (riff_size > UINT32_MAX) {
+		/* Switch to RF64: the actual sizes go in the ds64 chunk */
+		if (self->header.chunk_id != FOURCC_RF64)
+			ULOGI("'%s': switching to RF64", self->filename);
+		self->header.chunk_id = FOURCC_RF64;
+		self->header.chunk_size = WAVE_SIZE_DS64;
+		self->header.subchunk2_size = WAVE_SIZE_DS64;
+		chunk.id = FOURCC_ds64;
+		ds64.riff_size = riff_size;
+		ds64.data_size = data_length;
+		ds64.sample_count = data_length / self->header.block_align;
+	} else {
+		self->header.chunk_id = FOURCC_RIFF;
+		self->header.chunk_size = riff_size;
+		self->header.subchunk2_size = data_length;
+	}
+
+	memcpy(buf, &self->header, WAVE_RIFF_HEADER_SIZE);
+	off += WAVE_RIFF_HEADER_SIZE;
+	memcpy(buf + off, &chunk, sizeof(chunk));
+	off += sizeof(chunk);
+	memcpy(buf + off, &ds64, sizeof(ds64));
+	off += sizeof(ds64);
+	memcpy(buf + off, &self->header.subchunk1_id, WAVE_FMT_SIZE);
+	off += WAVE_FMT_SIZE;
+	memcpy(buf + off, &self->fmt_ext, ext_size);
+	off += ext_size;
+	memcpy(buf + off,
+	       &self->header.subchunk2_id,
+	       sizeof(self->header) - WAVE_RIFF_HEADER_SIZE - WAVE_FMT_SIZE);
+}
+
+
+static int file_pwrite(struct araw_writer *self,
+		       const uint8_t *data,
+		       size_t len,
+		       uint64_t pos)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = pwrite(araw_io_fd(&self->io), data, len, (off_t)pos);
+		araw_stats_io_add(&self->io.stats,
+				  1,
+				  ret > 0 ? ret : 0,
+				  ret >= 0 && (size_t)ret < len,
+				  false);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			ULOG_ERRNO("pwrite", (int)-ret);
+			return ret;
+		}
+		data += ret;
+		len -= ret;
+		pos += ret;
 	}
 
 	return 0;
 }
 
 
-int araw_writer_new(const char *filename,
-		    const struct araw_writer_config *config,
-		    struct araw_writer **ret_obj)
+static int wave_header_write(struct araw_writer *self)
 {
-	int ret = 0;
-	struct araw_writer *self = NULL;
+	int ret;
+	uint8_t buf[WAVE_HEADER_MAX_SIZE];
+	uint64_t start = araw_stats_now();
 
-	(void)pthread_once(&supported_formats_is_init,
-			   initialize_supported_formats);
+	wave_header_fill(self, self->data_length, buf);
 
-	ULOG_ERRNO_RETURN_ERR_IF(filename == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(!adef_format_intersect(&config->format,
-							supported_formats,
-							NB_SUPPORTED_FORMATS),
-				 EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	if (self->wbuf != NULL) {
+		/* Patch the header in place when writing through the
+		 * aggregation buffer */
+		ret = file_pwrite(self, buf, self->header_size, 0);
+	} else {
+		/* Write WAVE header */
+		ret = araw_io_write(&self->io, buf, self->header_size);
+		if (ret < 0)
+			ULOG_ERRNO("write", -ret);
+	}
+	araw_stats_header_add(&self->io.stats, start);
+	return ret;
+}
 
-	self = calloc(1, sizeof(*self));
-	if (self == NULL)
-		return -ENOMEM;
 
-	self->cfg = *config;
+/* Write the aggregation buffer content at its position in the file; all
+ * but the last flush are write_buf_size bytes at an aligned position */
+static int wave_buf_flush(struct araw_writer *self)
+{
+	int ret;
 
-	self->filename = strdup(filename);
-	if (self->filename == NULL) {
-		ret = -ENOMEM;
-		goto error;
+	ret = file_pwrite(self, self->wbuf, self->wbuf_len, self->wbuf_pos);
+	if (ret < 0)
+		return ret;
+
+	self->wbuf_pos += self->wbuf_len;
+	self->wbuf_len = 0;
+	return 0;
+}
+
+
+static int wave_buf_write(struct araw_writer *self,
+			  const uint8_t *data,
+			  size_t len)
+{
+	int ret;
+	size_t n;
+
+	while (len > 0) {
+		n = self->cfg.write_buf_size - self->wbuf_len;
+		if (n > len)
+			n = len;
+		memcpy(self->wbuf + self->wbuf_len, data, n);
+		self->wbuf_len += n;
+		data += n;
+		len -= n;
+
+		if (self->wbuf_len == self->cfg.write_buf_size) {
+			ret = wave_buf_flush(self);
+			if (ret < 0)
+				return ret;
+		}
 	}
 
-	self->file = fopen(self->filename, "wb");
-	if (self->file == NULL) {
-		ret = -errno;
-		ULOG_ERRNO("fopen('%s')", -ret, self->filename);
-		goto error;
+	return 0;
+}
+
+
+/* Allocate the aggregation buffer */
+static int wave_buf_init(struct araw_writer *self)
+{
+	int ret;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	self->cfg.write_buf_size = (self->cfg.write_buf_size + page_size - 1) &
+				   ~(page_size - 1);
+
+	ret = posix_memalign(
+		(void **)&self->wbuf, page_size, self->cfg.write_buf_size);
+	if (ret != 0) {
+		self->wbuf = NULL;
+		return -ret;
 	}
 
-	/* Write WAV file headers */
-	ret = wave_header_write(self);
+	return 0;
+}
+
+
+/* Enable or disable O_DIRECT, for unaligned writes */
+static int file_set_direct(struct araw_writer *self, bool enable)
+{
+#ifdef O_DIRECT
+	int ret, flags;
+
+	flags = fcntl(araw_io_fd(&self->io), F_GETFL);
+	if (flags < 0)
+		goto error;
+	flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+	ret = fcntl(araw_io_fd(&self->io), F_SETFL, flags);
+	araw_stats_io_add(&self->io.stats, 2, 0, false, false);
 	if (ret < 0)
 		goto error;
-
-	*ret_obj = self;
 	return 0;
 
 error:
-	(void)araw_writer_destroy(self);
-	*ret_obj = NULL;
+	ret = -errno;
+	ULOG_ERRNO("fcntl", -ret);
 	return ret;
+#else
+	return enable ? -ENOTSUP : 0;
+#endif
 }
 
 
-int araw_writer_destroy(struct araw_writer *self)
+/* Write the rest of the aggregation buffer on file-close */
+static int wave_buf_close(struct araw_writer *self)
 {
 	int ret;
 
-	if (self == NULL)
-		return 0;
+	if (self->cfg.direct_io) {
+		/* The tail is not a multiple of the block size */
+		ret = file_set_direct(self, false);
+		if (ret < 0)
+			return ret;
+	}
 
-	if (self->file == NULL) {
-		ret = -EINVAL;
-		goto out;
+	return wave_buf_flush(self);
+}
+
+
+/* Reserve the file space ahead of the data in prealloc_size chunks; the
+ * file size is unchanged and the unused space is released on file-close */
+static void wave_prealloc(struct araw_writer *self, size_t len)
+{
+	int ret;
+	uint64_t end = self->header_size + self->data_length + len;
+
+	if (self->cfg.prealloc_size == 0 || end <= self->prealloc_end)
+		return;
+
+#ifdef FALLOC_FL_KEEP_SIZE
+	while (self->prealloc_end < end) {
+		ret = fallocate(araw_io_fd(&self->io),
+				FALLOC_FL_KEEP_SIZE,
+				(off_t)self->prealloc_end,
+				(off_t)self->cfg.prealloc_size);
+		araw_stats_io_add(&self->io.stats, 1, 0, false, false);
+		if (ret < 0) {
+			ret = -errno;
+			ULOG_ERRNO("fallocate", -ret);
+			/* Not supported by the file system: do not retry */
+			if (ret == -EOPNOTSUPP || ret == -ENOSYS)
+				self->cfg.prealloc_size = 0;
+			return;
+		}
+		self->prealloc_end += self->cfg.prealloc_size;
 	}
+#else
+	(void)ret;
+	ULOGW("preallocation not supported");
+	self->cfg.prealloc_size = 0;
+#endif
+}
 
-	self->header.subchunk2_size = self->data_length;
-	self->header.chunk_size = offsetof(struct wave_header, subchunk2_id) +
-				  self->header.subchunk2_size;
 
-	/* Seek to "chunk_size" in WAVE header */
-	ret = fseek(
-		self->file, offsetof(struct wave_header, chunk_size), SEEK_SET);
-	if (ret != 0) {
-		ret = -errno;
-		ULOG_ERRNO("fseek", -ret);
-		goto out;
+/* Length of the data that a checkpoint can cover: with an aggregation
+ * buffer, only the data already flushed from it */
+static uint64_t wave_checkpoint_length(struct araw_writer *self)
+{
+	if (self->wbuf == NULL)
+		return self->data_length;
+	if (self->wbuf_pos <= self->header_size)
+		return 0;
+	return self->wbuf_pos - self->header_size;
+}
+
+
+/* Update the header sizes up to the data already written to the file; the
+ * data is synced first, so that the header never covers data lost after a
+ * crash */
+static int wave_header_checkpoint(struct araw_writer *self)
+{
+	int ret;
+	uint8_t buf[WAVE_HEADER_MAX_SIZE];
+	uint64_t data_length;
+	uint64_t start = araw_stats_now();
+
+	data_length = wave_checkpoint_length(self);
+	if (data_length == self->checkpoint_length) {
+		/* Nothing new to cover: restart the period */
+		clock_gettime(CLOCK_MONOTONIC, &self->checkpoint_ts);
+		return 0;
 	}
 
-	/* Fill "self->header.chunk_size" in on file-close */
-	ret = fwrite(&self->header.chunk_size,
-		     sizeof(self->header.chunk_size),
-		     1,
-		     self->file);
-	if (ret != 1) {
+	if (self->wbuf == NULL && fflush(self->io.file) != 0) {
 		ret = -errno;
-		ULOG_ERRNO("fwrite", -ret);
-		goto out;
+		ULOG_ERRNO("fflush", -ret);
+		return ret;
 	}
 
-	/* Seek to "subchunk2_size" in WAVE header */
-	ret = fseek(self->file,
-		    offsetof(struct wave_header, subchunk2_size),
-		    SEEK_SET);
-	if (ret != 0) {
+	ret = fdatasync(araw_io_fd(&self->io));
+	araw_stats_io_add(&self->io.stats, 1, 0, false, false);
+	if (ret < 0) {
 		ret = -errno;
-		ULOG_ERRNO("fseek", -ret);
-		goto out;
+		ULOG_ERRNO("fdatasync", -ret);
+		return ret;
+	}
+
+	wave_header_fill(self, data_length, buf);
+	if (self->cfg.direct_io) {
+		ret = file_set_direct(self, false);
+		if (ret < 0)
+			return ret;
+	}
+	ret = file_pwrite(self, buf, self->header_size, 0);
+	if (self->cfg.direct_io)
+		(void)file_set_direct(self, true);
+	araw_stats_header_add(&self->io.stats, start);
+	if (ret < 0)
+		return ret;
+
+	self->checkpoint_length = data_length;
+	clock_gettime(CLOCK_MONOTONIC, &self->checkpoint_ts);
+	return 0;
+}
+
+
+static bool wave_checkpoint_is_due(struct araw_writer *self)
+{
+	struct timespec ts;
+	uint64_t elapsed_ms;
+
+	if (self->cfg.checkpoint_bytes > 0 &&
+	    wave_checkpoint_length(self) - self->checkpoint_length >=
+		    self->cfg.checkpoint_bytes)
+		return true;
+
+	if (self->cfg.checkpoint_ms == 0)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	elapsed_ms = (uint64_t)(ts.tv_sec - self->checkpoint_ts.tv_sec) * 1000 +
+		     (ts.tv_nsec - self->checkpoint_ts.tv_nsec) / 1000000;
+	return elapsed_ms >= self->cfg.checkpoint_ms;
+}
+
+
+static int wave_writev_file(struct araw_writer *self,
+			    const struct iovec *iov,
+			    int iovcnt,
+			    size_t len)
+{
+	int ret, i;
+
+	wave_prealloc(self, len);
+
+	if (self->wbuf != NULL) {
+		for (i = 0; i < iovcnt; i++) {
+			ret = wave_buf_write(
+				self, iov[i].iov_base, iov[i].iov_len);
+			if (ret < 0)
+				return ret;
+		}
+	} else {
+		ret = araw_io_writev(&self->io, iov, iovcnt);
+		if (ret < 0) {
+			ULOG_ERRNO("writev", -ret);
+			return ret;
+		}
+	}
+
+	self->data_length += len;
+
+	if (wave_checkpoint_is_due(self)) {
+		ret = wave_header_checkpoint(self);
+		if (ret < 0)
+			return ret;
 	}
 
-	/* Fill "self->header.subchunk2_size" in on file-close */
-	ret = fwrite(&self->header.subchunk2_size,
-		     sizeof(self->header.subchunk2_size),
-		     1,
-		     self->file);
-	if (ret != 1) {
+	return 0;
+}
+
+
+/* Open the file for writing */
+static int writer_file_open(struct araw_writer *self)
+{
+	int ret, fd, flags;
+	FILE *file;
+
+	flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (self->cfg.direct_io)
+		flags |= O_DIRECT;
+#endif
+	fd = open(self->filename, flags, 0666);
+	if (fd < 0) {
 		ret = -errno;
-		ULOG_ERRNO("fwrite", -ret);
+		ULOG_ERRNO("open('%s')", -ret, self->filename);
+		return ret;
+	}
+
+	if (self->cfg.uring) {
+		ret = araw_io_init_uring(&self->io, fd);
+		if (ret < 0) {
+			ULOG_ERRNO("araw_io_init_uring", -ret);
+			close(fd);
+			return ret;
+		}
+	} else {
+		file = fdopen(fd, "wb");
+		if (file == NULL) {
+			ret = -errno;
+			ULOG_ERRNO("fdopen('%s')", -ret, self->filename);
+			close(fd);
+			return ret;
+		}
+		araw_io_init_file(&self->io, file);
+	}
+
+	return 0;
+}
+
+
+/* Write the WAVE header of a new file, through the aggregation buffer if
+ * any */
+static int wave_file_start(struct araw_writer *self)
+{
+	int ret;
+	uint8_t buf[WAVE_HEADER_MAX_SIZE];
+
+	self->data_length = 0;
+	self->checkpoint_length = 0;
+	self->prealloc_end = 0;
+
+	wave_header_init(self);
+	if (self->wbuf != NULL) {
+		self->wbuf_len = 0;
+		self->wbuf_pos = 0;
+		wave_header_fill(self, 0, buf);
+		ret = wave_buf_write(self, buf, self->header_size);
+	} else {
+		ret = wave_header_write(self);
+	}
+	if (ret < 0)
+		return ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &self->checkpoint_ts);
+	return 0;
+}
+
+
+/* Fill the sizes in the WAVE header, then close the file */
+static int wave_file_close(struct araw_writer *self)
+{
+	int ret, err;
+
+	if (self->wbuf != NULL) {
+		ret = wave_buf_close(self);
+		if (ret < 0)
+			goto out;
+	} else {
+		ret = araw_io_seek(&self->io, 0, SEEK_SET);
+		if (ret < 0) {
+			ULOG_ERRNO("seek", -ret);
+			goto out;
+		}
+	}
+
+	ret = wave_header_write(self);
+	if (ret < 0)
 		goto out;
+
+	if (self->cfg.prealloc_size > 0) {
+		/* Release the preallocated space beyond the data */
+		if (fflush(self->io.file) != 0 ||
+		    ftruncate(araw_io_fd(&self->io),
+			      (off_t)(self->header_size + self->data_length)) <
+			    0) {
+			ret = -errno;
+			ULOG_ERRNO("ftruncate", -ret);
+			goto out;
+		}
 	}
 
-	ret = 0;
 out:
-	if (self->file != NULL)
-		fclose(self->file);
-
-	free(self->filename);
-	free(self);
+	err = araw_io_close(&self->io);
+	if (ret == 0)
+		ret = err;
+	if (ret == 0 && self->cfg.segment_done != NULL) {
+		self->cfg.segment_done(self,
+				       self->filename,
+				       self->segment_index,
+				       self->cfg.segment_userdata);
+	}
 	return ret;
 }
 
 
-int araw_writer_frame_write(struct araw_writer *self,
-			    const struct araw_frame *frame)
+/* Complete the current segment and start the next one */
+static int writer_segment_next(struct araw_writer *self)
 {
-	int ret = 0;
-	const uint8_t *ptr;
+	int ret, err;
+	char *filename;
 
-	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(
-		!adef_format_cmp(&frame->frame.format, &self->cfg.format),
-		EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(self->file == NULL, EPROTO);
+	/* Go on with the next segment even if this one failed */
+	err = wave_file_close(self);
+	if (err < 0)
+		ULOG_ERRNO("'%s': segment completion", -err, self->filename);
 
-	/* Write PCM data to file */
-	ptr = frame->cdata;
-	ret = fwrite(ptr, frame->cdata_length, 1, self->file);
-	if (ret != 1) {
-		ret = -errno;
-		ULOG_ERRNO("fwrite", -ret);
+	filename = araw_segment_name(self->segment_base,
+				     self->segment_index + 1);
+	if (filename == NULL)
+		return -ENOMEM;
+	free(self->filename);
+	self->filename = filename;
+	self->segment_index++;
+
+	ret = writer_file_open(self);
+	if (ret < 0)
 		return ret;
+
+	ret = wave_file_start(self);
+	if (ret < 0)
+		return ret;
+
+	return err;
+}
+
+
+/* Write the data across the segment files, rolling to the next file on
+ * each segment boundary */
+static int wave_writev_segments(struct araw_writer *self,
+				const struct iovec *iov,
+				int iovcnt,
+				size_t len)
+{
+	int ret, n;
+	struct iovec part[ARAW_IOV_BATCH];
+	size_t off = 0, part_len, l;
+	uint64_t room;
+
+	while (len > 0) {
+		/* The next file failed to open */
+		if (self->io.ops == NULL)
+			return -EPROTO;
+
+		room = self->segment_size - self->data_length;
+		if (room == 0) {
+			ret = writer_segment_next(self);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		/* Buffers up to the segment boundary */
+		n = 0;
+		part_len = 0;
+		while (n < ARAW_IOV_BATCH && iovcnt > 0 && part_len < room) {
+			l = iov->iov_len - off;
+			if (l > room - part_len)
+				l = room - part_len;
+			part[n].iov_base = (uint8_t *)iov->iov_base + off;
+			part[n].iov_len = l;
+			n++;
+			part_len += l;
+			off += l;
+			if (off == iov->iov_len) {
+				iov++;
+				iovcnt--;
+				off = 0;
+			}
+		}
+
+		ret = wave_writev_file(self, part, n, part_len);
+		if (ret < 0)
+			return ret;
+		len -= part_len;
 	}
 
-	self->data_length += frame->cdata_length;
 	return 0;
 }
+
+
+static int wave_writev_data(struct araw_writer *self,
+			    const struct iovec *iov,
+			    int iovcnt,
+			    size_t len)
+{
+	if (self->segment_size == 0 ||
+	    self->data_length + len <= self->segment_size)
+		return wave_writev_file(self, iov, iovcnt, len);
+
+	return wave_writev_segments(self, iov, iovcnt, len);
+}
+
+
+static int wave_write_data(struct araw_writer *self,
+			   const uint8_t *data,
+			   size_t len)
+{
+	struct iovec iov = {
+		.iov_base = (void *)data,
+		.iov_len = len,
+	};
+
+	return wave_writev_data(self, &iov, 1, len);
+}
+
+
+/* Write all the queued frames */
+static void writer_async_drain(struct araw_writer *self)
+{
+	int ret;
+	const uint8_t *data;
+	size_t len;
+
+	while ((data = araw_ring_pop_get(&self->ring, &len)) != NULL) {
+		ret = wave_write_data(self, data, len);
+		araw_ring_pop_commit(&self->ring);
+		if (ret < 0)
+			__atomic_store_n(&self->async_err, ret, __ATOMIC_RELEASE);
+	}
+}
+
+
+static void *writer_thread(void *ptr)
+{
+	struct araw_writer *self = ptr;
+
+	while (1) {
+		while (sem_wait(&self->sem) < 0 && errno == EINTR)
+			;
+
+		writer_async_drain(self);
+
+		if (__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE) &&
+		    araw_ring_level(&self->ring) == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+
+unsigned int araw_writer_async_write(struct araw_writer *self,
+				     struct iovec *iov,
+				     unsigned int max)
+{
+	int ret;
+	unsigned int n = 0;
+	uint8_t *data;
+	size_t len, total = 0;
+
+	while (n < max) {
+		data = araw_ring_peek(&self->ring, n, &len);
+		if (data == NULL)
+			break;
+		iov[n].iov_base = data;
+		iov[n].iov_len = len;
+		total += len;
+		n++;
+	}
+	if (n == 0)
+		return 0;
+
+	ret = wave_writev_data(self, iov, n, total);
+	araw_ring_pop_commit_count(&self->ring, n);
+	if (ret < 0)
+		__atomic_store_n(&self->async_err, ret, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+
+static void writer_async_notify(struct araw_writer *self)
+{
+	unsigned int level = araw_ring_level(&self->ring);
+
+	if (level > __atomic_load_n(&self->queue_max, __ATOMIC_RELAXED))
+		__atomic_store_n(&self->queue_max, level, __ATOMIC_RELAXED);
+
+	if (self->group_attached)
+		araw_writer_group_notify(self->cfg.group);
+	else
+		sem_post(&self->sem);
+}
+
+
+static int writer_async_start(struct araw_writer *self)
+{
+	int ret;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self->cfg.async_buf_size == 0, EINVAL);
+
+	ret = araw_ring_init(
+		&self->ring, self->cfg.async_depth, self->cfg.async_buf_size);
+	if (ret < 0) {
+		ULOG_ERRNO("araw_ring_init", -ret);
+		return ret;
+	}
+
+	if (self->cfg.group != NULL) {
+		ret = araw_writer_group_attach(self->cfg.group, self);
+		if (ret < 0) {
+			ULOG_ERRNO("araw_writer_group_attach", -ret);
+			return ret;
+		}
+		self->group_attached = true;
+		return 0;
+	}
+
+	ret = sem_init(&self->sem, 0, 0);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("sem_init", -ret);
+		return ret;
+	}
+	self->sem_created = true;
+
+	ret = pthread_create(&self->thread, NULL, writer_thread, self);
+	if (ret != 0) {
+		ULOG_ERRNO("pthread_create", ret);
+		return -ret;
+	}
+	self->thread_launched = true;
+
+	return 0;
+}
+
+
+static int writer_async_stop(struct araw_writer *self)
+{
+	if (self->group_attached) {
+		/* Once detached, the scheduler thread no longer accesses the
+		 * writer: the remaining frames are written here */
+		araw_writer_group_detach(self->cfg.group, self);
+		self->group_attached = false;
+		writer_async_drain(self);
+	}
+
+	if (self->thread_launched) {
+		__atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+		sem_post(&self->sem);
+		pthread_join(self->thread, NULL);
+		self->thread_launched = false;
+	}
+
+	if (self->sem_created) {
+		sem_destroy(&self->sem);
+		self->sem_created = false;
+	}
+
+	araw_ring_clear(&self->ring);
+
+	if (self->overruns > 0)
+		ULOGW("%u frame(s) dropped in asynchronous mode",
+		      self->overruns);
+
+	return __atomic_exchange_n(&self->async_err, 0, __ATOMIC_ACQ_REL);
+}
+
+
+static int writer_convert_init(struct araw_writer *self)
+{
+	int ret;
+
+	if (self->cfg.input_sample_format == ARAW_SAMPLE_FORMAT_UNKNOWN) {
+		self->conv.identity = true;
+		self->conv.src_size = self->cfg.format.bit_depth / 8;
+		self->conv.dst_size = self->conv.src_size;
+		return 0;
+	}
+
+	/* The input endianness is updated from the frames */
+	ret = araw_convert_init(&self->conv,
+				self->cfg.input_sample_format,
+				ARAW_HOST_LE,
+				self->file_sample_format,
+				self->cfg.format.pcm.little_endian);
+	if (ret < 0)
+		ULOG_ERRNO("araw_convert_init", -ret);
+	return ret;
+}
+
+
+static bool frame_format_is_valid(struct araw_writer *self,
+				  const struct adef_format *format)
+{
+	enum araw_sample_format sample_format = self->cfg.input_sample_format;
+	struct adef_format tmp;
+
+	if (sample_format == ARAW_SAMPLE_FORMAT_UNKNOWN) {
+		/* Planar frames are interleaved before being written */
+		tmp = *format;
+		if (!tmp.pcm.interleaved)
+			tmp.pcm.interleaved = self->cfg.format.pcm.interleaved;
+		return adef_format_cmp(&tmp, &self->cfg.format);
+	}
+
+	return format->encoding == ADEF_ENCODING_PCM &&
+	       format->channel_count == self->cfg.format.channel_count &&
+	       format->sample_rate == self->cfg.format.sample_rate &&
+	       format->bit_depth ==
+		       8 * araw_sample_format_size(sample_format) &&
+	       format->pcm.signed_val ==
+		       (sample_format != ARAW_SAMPLE_FORMAT_U8);
+}
+
+
+static int buffer_grow(uint8_t **buf, size_t *size, size_t min_size)
+{
+	uint8_t *tmp;
+
+	if (min_size <= *size)
+		return 0;
+
+	tmp = realloc(*buf, min_size);
+	if (tmp == NULL)
+		return -ENOMEM;
+	*buf = tmp;
+	*size = min_size;
+
+	return 0;
+}
+
+
+/* Number of samples per channel in a frame */
+static size_t frame_sample_count(struct araw_writer *self,
+				 const struct araw_frame *frame)
+{
+	size_t stride;
+
+	if (frame->frame.format.pcm.interleaved)
+		return frame->cdata_length / self->conv.src_size /
+		       self->cfg.format.channel_count;
+
+	stride = frame->cdata_length / self->cfg.format.channel_count;
+	if (self->cfg.frame_length == 0)
+		return stride / self->conv.src_size;
+	if (self->cfg.frame_length * self->conv.src_size > stride)
+		return 0;
+	return self->cfg.frame_length;
+}
+
+
+/* Convert the frame samples to the data format and layout into dst;
+ * returns the converted size, or a negative errno value in case of error */
+static ssize_t frame_prepare(struct araw_writer *self,
+			     const struct araw_frame *frame,
+			     uint8_t *dst,
+			     size_t dst_size)
+{
+	int ret;
+	const uint8_t *src = frame->cdata;
+	size_t sample_count = frame_sample_count(self, frame);
+	size_t count = sample_count * self->cfg.format.channel_count;
+	size_t size = count * self->conv.dst_size;
+
+	if (sample_count == 0)
+		return -EINVAL;
+	if (size > dst_size)
+		return -ENOBUFS;
+
+	if (!frame->frame.format.pcm.interleaved) {
+		/* Merge the planes, straight into the destination if no
+		 * conversion is needed */
+		if (self->planar.channel_count == 0) {
+			ret = araw_planar_init(&self->planar,
+					       self->cfg.format.channel_count,
+					       self->conv.src_size);
+			if (ret < 0)
+				return ret;
+		}
+		if (!self->conv.identity) {
+			ret = buffer_grow(&self->interleaved,
+					  &self->interleaved_size,
+					  count * self->conv.src_size);
+			if (ret < 0)
+				return ret;
+		}
+		self->planar.interleave(
+			&self->planar,
+			self->conv.identity ? dst : self->interleaved,
+			src,
+			frame->cdata_length / self->cfg.format.channel_count,
+			sample_count);
+		if (self->conv.identity)
+			return size;
+		src = self->interleaved;
+	}
+
+	if (!self->conv.identity &&
+	    self->conv.src_le != frame->frame.format.pcm.little_endian) {
+		ret = araw_convert_init(&self->conv,
+					self->conv.src_format,
+					frame->frame.format.pcm.little_endian,
+					self->conv.dst_format,
+					self->conv.dst_le);
+		if (ret < 0)
+			return ret;
+	}
+
+	araw_convert_run(&self->conv, dst, src, count);
+	return size;
+}
+
+
+static int writer_alloc(const char *name,
+			const struct araw_writer_config *config,
+			struct araw_writer **ret_obj)
+{
+	struct araw_writer *self;
+	struct adef_format format;
+
+	ULOG_ERRNO_RETURN_ERR_IF(config->direct_io && config->write_buf_size == 0,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->group != NULL && config->async_depth == 0,
+				 EINVAL);
+#ifndef O_DIRECT
+	ULOG_ERRNO_RETURN_ERR_IF(config->direct_io, ENOTSUP);
+#endif
+
+	format = config->format;
+	if (config->sample_format != ARAW_SAMPLE_FORMAT_UNKNOWN) {
+		araw_sample_format_to_adef(config->sample_format, &format);
+		format.pcm.little_endian = config->format.pcm.little_endian;
+	}
+	ULOG_ERRNO_RETURN_ERR_IF(
+		!araw_format_is_supported(&format, config->sample_format),
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->valid_bits > format.bit_depth, EINVAL);
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+
+	self->cfg = *config;
+	self->cfg.format = format;
+	self->file_sample_format =
+		config->sample_format != ARAW_SAMPLE_FORMAT_UNKNOWN
+			? config->sample_format
+			: araw_sample_format_from_adef(&format);
+
+	self->filename = strdup(name);
+	if (self->filename == NULL) {
+		free(self);
+		return -ENOMEM;
+	}
+
+	*ret_obj = self;
+	return 0;
+}
+
+
+/* Write the header and set up the writer once the file is opened */
+static int writer_open(struct araw_writer *self)
+{
+	int ret;
+
+	if (araw_io_fd(&self->io) < 0) {
+		/* Features relying on a file descriptor */
+		ULOG_ERRNO_RETURN_ERR_IF(self->cfg.write_buf_size > 0 ||
+						 self->cfg.prealloc_size > 0 ||
+						 self->cfg.checkpoint_bytes > 0 ||
+						 self->cfg.checkpoint_ms > 0,
+					 EOPNOTSUPP);
+	}
+
+	ret = writer_convert_init(self);
+	if (ret < 0)
+		return ret;
+
+	if (self->cfg.write_buf_size > 0) {
+		ret = wave_buf_init(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Write WAV file headers */
+	ret = wave_file_start(self);
+	if (ret < 0)
+		return ret;
+
+	if (self->cfg.async_depth > 0) {
+		ret = writer_async_start(self);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+
+/* Segmented mode: the files are named after the given file name */
+static int writer_segment_init(struct araw_writer *self)
+{
+	uint64_t sample_size, size = 0, bytes;
+
+	sample_size = self->cfg.format.channel_count *
+		      (self->cfg.format.bit_depth / 8);
+	if (self->cfg.segment_ms > 0) {
+		size = (uint64_t)self->cfg.segment_ms *
+		       self->cfg.format.sample_rate / 1000 * sample_size;
+	}
+	if (self->cfg.segment_bytes > 0) {
+		/* Split on a sample boundary */
+		bytes = self->cfg.segment_bytes / sample_size * sample_size;
+		if (size == 0 || bytes < size)
+			size = bytes;
+	}
+	ULOG_ERRNO_RETURN_ERR_IF(size == 0, EINVAL);
+	self->segment_size = size;
+
+	self->segment_base = self->filename;
+	self->filename = araw_segment_name(self->segment_base, 0);
+	if (self->filename == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+
+int araw_writer_new(const char *filename,
+		    const struct araw_writer_config *config,
+		    struct araw_writer **ret_obj)
+{
+	int ret = 0;
+	struct araw_writer *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(filename == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = writer_alloc(filename, config, &self);
+	if (ret < 0)
+		return ret;
+
+	if (self->cfg.segment_bytes > 0 || self->cfg.segment_ms > 0) {
+		ret = writer_segment_init(self);
+		if (ret < 0)
+			goto error;
+	}
+
+	ret = writer_file_open(self);
+	if (ret < 0)
+		goto error;
+
+	ret = writer_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	(void)araw_writer_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_writer_new_from_io(const struct araw_io_ops *ops,
+			    void *userdata,
+			    const struct araw_writer_config *config,
+			    struct araw_writer **ret_obj)
+{
+	int ret = 0;
+	struct araw_writer *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(ops == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ops->write == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ops->seek == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->direct_io, EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->segment_bytes > 0 || config->segment_ms > 0,
+		EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = writer_alloc("io", config, &self);
+	if (ret < 0)
+		return ret;
+
+	araw_io_init_ops(&self->io, ops, userdata);
+
+	ret = writer_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	(void)araw_writer_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_writer_new_from_buffer(uint8_t *data,
+				size_t size,
+				size_t *len,
+				const struct araw_writer_config *config,
+				struct araw_writer **ret_obj)
+{
+	int ret = 0;
+	struct araw_writer *self = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(data == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->direct_io, EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->segment_bytes > 0 || config->segment_ms > 0,
+		EOPNOTSUPP);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	ret = writer_alloc("buffer", config, &self);
+	if (ret < 0)
+		return ret;
+
+	*len = 0;
+	araw_io_init_mem(&self->io, data, size, 0);
+	self->io.mem_len_out = len;
+
+	ret = writer_open(self);
+	if (ret < 0)
+		goto error;
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	(void)araw_writer_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_writer_destroy(struct araw_writer *self)
+{
+	int ret, async_ret;
+
+	if (self == NULL)
+		return 0;
+
+	/* Flush the pending frames in asynchronous mode */
+	async_ret = writer_async_stop(self);
+	if (async_ret < 0)
+		ULOG_ERRNO("asynchronous write", -async_ret);
+
+	/* Nothing to update if creation failed before the header */
+	if (self->io.ops == NULL || self->header_size == 0) {
+		araw_io_close(&self->io);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Fill the sizes in the WAVE header on file-close */
+	ret = wave_file_close(self);
+	if (ret < 0)
+		goto out;
+
+	ret = async_ret;
+out:
+	free(self->wbuf);
+	free(self->interleaved);
+	free(self->scratch);
+	free(self->gather);
+	free(self->filename);
+	free(self->segment_base);
+	free(self);
+	return ret;
+}
+
+
+static void iov_gather(uint8_t *dst, const struct iovec *iov, int iovcnt)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+		dst += iov[i].iov_len;
+	}
+}
+
+
+/* Write the len bytes of frame data given as iovcnt buffers */
+static int frame_write(struct araw_writer *self,
+		       const struct adef_format *format,
+		       const struct iovec *iov,
+		       int iovcnt,
+		       size_t len)
+{
+	int ret = 0;
+	ssize_t size;
+	uint8_t *slot = NULL;
+	bool as_is, async;
+	struct araw_frame frame;
+
+	/* Frames already in the data format and layout */
+	as_is = self->conv.identity && format->pcm.interleaved;
+
+	async = self->thread_launched || self->group_attached;
+
+	if (!async && as_is) {
+		/* Write PCM data to file */
+		return wave_writev_data(self, iov, iovcnt, len);
+	}
+
+	if (async) {
+		/* Report errors from the writer thread */
+		ret = __atomic_exchange_n(
+			&self->async_err, 0, __ATOMIC_ACQ_REL);
+		if (ret < 0)
+			return ret;
+
+		/* Queue PCM data for the writer thread; never block */
+		slot = araw_ring_push_get(&self->ring);
+		if (slot == NULL) {
+			__atomic_add_fetch(
+				&self->overruns, 1, __ATOMIC_RELAXED);
+			return -EAGAIN;
+		}
+		if (as_is) {
+			ULOG_ERRNO_RETURN_ERR_IF(
+				len > self->cfg.async_buf_size, ENOBUFS);
+			iov_gather(slot, iov, iovcnt);
+			araw_ring_push_commit(&self->ring, len);
+			writer_async_notify(self);
+			return 0;
+		}
+	}
+
+	/* The samples are converted from a contiguous buffer */
+	memset(&frame, 0, sizeof(frame));
+	frame.frame.format = *format;
+	frame.cdata_length = len;
+	if (iovcnt == 1) {
+		frame.cdata = iov[0].iov_base;
+	} else {
+		ret = buffer_grow(&self->gather, &self->gather_size, len);
+		if (ret < 0)
+			return ret;
+		iov_gather(self->gather, iov, iovcnt);
+		frame.cdata = self->gather;
+	}
+
+	if (slot != NULL) {
+		size = frame_prepare(
+			self, &frame, slot, self->cfg.async_buf_size);
+		ULOG_ERRNO_RETURN_ERR_IF(size < 0, (int)-size);
+		araw_ring_push_commit(&self->ring, size);
+		writer_async_notify(self);
+		return 0;
+	}
+
+	/* Convert PCM data to the data format, then write it */
+	ret = buffer_grow(&self->scratch,
+			  &self->scratch_size,
+			  frame_sample_count(self, &frame) *
+				  self->cfg.format.channel_count *
+				  self->conv.dst_size);
+	if (ret < 0)
+		return ret;
+	size = frame_prepare(self, &frame, self->scratch, self->scratch_size);
+	if (size < 0)
+		return size;
+	return wave_write_data(self, self->scratch, size);
+}
+
+
+int araw_writer_frame_write(struct araw_writer *self,
+			    const struct araw_frame *frame)
+{
+	int ret;
+	struct iovec iov;
+	uint64_t start = araw_stats_now();
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frame == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		!frame_format_is_valid(self, &frame->frame.format), EINVAL);
+	/* Not io.ops: the file is replaced between segments by the thread
+	 * writing the data */
+	ULOG_ERRNO_RETURN_ERR_IF(self->header_size == 0, EPROTO);
+
+	iov.iov_base = (void *)frame->cdata;
+	iov.iov_len = frame->cdata_length;
+	ret = frame_write(
+		self, &frame->frame.format, &iov, 1, frame->cdata_length);
+	if (ret == 0)
+		araw_stats_frames_add(&self->stats, 1, start);
+
+	return ret;
+}
+
+
+int araw_writer_frame_writev(struct araw_writer *self,
+			     const struct adef_format *format,
+			     const struct iovec *iov,
+			     int iovcnt)
+{
+	int ret, i;
+	size_t len = 0;
+	uint64_t start = araw_stats_now();
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(format == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(iov == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(iovcnt <= 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!frame_format_is_valid(self, format), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->header_size == 0, EPROTO);
+
+	for (i = 0; i < iovcnt; i++) {
+		ULOG_ERRNO_RETURN_ERR_IF(iov[i].iov_len > SIZE_MAX - len,
+					 EINVAL);
+		len += iov[i].iov_len;
+	}
+
+	ret = frame_write(self, format, iov, iovcnt, len);
+	if (ret == 0)
+		araw_stats_frames_add(&self->stats, 1, start);
+
+	return ret;
+}
+
+
+int araw_writer_frames_write(struct araw_writer *self,
+			     const struct araw_frame *frames,
+			     unsigned int count)
+{
+	int ret;
+	unsigned int i, n, done = 0;
+	size_t len;
+	struct iovec iov[ARAW_IOV_BATCH];
+	uint64_t start = araw_stats_now();
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(frames == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(self->header_size == 0, EPROTO);
+	for (i = 0; i < count; i++)
+		ULOG_ERRNO_RETURN_ERR_IF(
+			!frame_format_is_valid(self, &frames[i].frame.format),
+			EINVAL);
+
+	while (done < count) {
+		if (self->thread_launched || self->group_attached ||
+		    !self->conv.identity ||
+		    !frames[done].frame.format.pcm.interleaved) {
+			/* One frame at a time */
+			iov[0].iov_base = (void *)frames[done].cdata;
+			iov[0].iov_len = frames[done].cdata_length;
+			ret = frame_write(self,
+					  &frames[done].frame.format,
+					  iov,
+					  1,
+					  iov[0].iov_len);
+			n = 1;
+		} else {
+			/* Consecutive frames written as is in a single
+			 * write */
+			len = 0;
+			for (n = 0; n < ARAW_IOV_BATCH && done + n < count &&
+				    frames[done + n].frame.format.pcm.interleaved;
+			     n++) {
+				iov[n].iov_base = (void *)frames[done + n].cdata;
+				iov[n].iov_len = frames[done + n].cdata_length;
+				len += iov[n].iov_len;
+			}
+			ret = wave_writev_data(self, iov, n, len);
+		}
+		if (ret < 0) {
+			if (done == 0)
+				return ret;
+			break;
+		}
+		done += n;
+	}
+	araw_stats_frames_add(&self->stats, done, start);
+
+	return done;
+}
+
+
+int araw_writer_get_overrun_count(struct araw_writer *self,
+				  unsigned int *count)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == NULL, EINVAL);
+
+	*count = __atomic_load_n(&self->overruns, __ATOMIC_RELAXED);
+	return 0;
+}
+
+
+int araw_writer_get_stats(struct araw_writer *self,
+			  struct araw_writer_stats *stats)
+{
+#if ARAW_STATS_ENABLED
+	struct araw_stats_io io;
+	struct araw_stats_frames frames;
+
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	araw_stats_read(&self->io.stats.seq, &io, sizeof(io));
+	araw_stats_read(&self->stats.seq, &frames, sizeof(frames));
+
+	memset(stats, 0, sizeof(*stats));
+	stats->bytes = io.bytes;
+	stats->frames = frames.frames;
+	stats->io_calls = io.calls;
+	stats->seeks = io.seeks;
+	stats->short_writes = io.short_count;
+	stats->frame_write = frames.latency;
+	stats->header_write = io.header;
+	stats->overruns = __atomic_load_n(&self->overruns, __ATOMIC_RELAXED);
+	stats->queue_max = __atomic_load_n(&self->queue_max, __ATOMIC_RELAXED);
+
+	return 0;
+#else
+	ULOG_ERRNO_RETURN_ERR_IF(self == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	return -ENOTSUP;
+#endif
+}
@@ -0,0 +1,236 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "araw_priv.h"
+
+#define ULOG_TAG araw
+#include <ulog.h>
+
+
+struct araw_writer_group {
+	struct araw_writer_group_config cfg;
+	struct iovec *iov;
+
+	pthread_t thread;
+	bool thread_launched;
+	sem_t sem;
+	bool sem_created;
+	int stop;
+	/* Set by the writers when frames are queued, cleared by the
+	 * scheduler thread before draining the queues */
+	int pending;
+
+	/* Protected by mutex; held by the scheduler thread while draining
+	 * the queues, so that a writer is never detached while written */
+	pthread_mutex_t mutex;
+	struct araw_writer **writers;
+	unsigned int writer_count;
+	unsigned int writer_capacity;
+	/* First writer served on the next round */
+	unsigned int next;
+};
+
+
+static void *group_thread(void *ptr)
+{
+	struct araw_writer_group *self = ptr;
+	unsigned int i, count;
+	bool active;
+
+	while (1) {
+		while (sem_wait(&self->sem) < 0 && errno == EINTR)
+			;
+
+		do {
+			__atomic_exchange_n(&self->pending, 0, __ATOMIC_SEQ_CST);
+
+			/* Serve each writer in turn, up to the quantum; start
+			 * from the next writer on each round */
+			active = false;
+			pthread_mutex_lock(&self->mutex);
+			count = self->writer_count;
+			for (i = 0; i < count; i++) {
+				if (araw_writer_async_write(
+					    self->writers[(self->next + i) %
+							  count],
+					    self->iov,
+					    self->cfg.quantum) > 0)
+					active = true;
+			}
+			if (count > 0)
+				self->next = (self->next + 1) % count;
+			pthread_mutex_unlock(&self->mutex);
+		} while (active);
+
+		if (__atomic_load_n(&self->stop, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	return NULL;
+}
+
+
+int araw_writer_group_new(const struct araw_writer_group_config *config,
+			  struct araw_writer_group **ret_obj)
+{
+	int ret;
+	struct araw_writer_group *self;
+
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	self = calloc(1, sizeof(*self));
+	if (self == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&self->mutex, NULL);
+
+	self->cfg = *config;
+	if (self->cfg.quantum == 0)
+		self->cfg.quantum = ARAW_GROUP_QUANTUM;
+
+	self->iov = calloc(self->cfg.quantum, sizeof(*self->iov));
+	if (self->iov == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	ret = sem_init(&self->sem, 0, 0);
+	if (ret < 0) {
+		ret = -errno;
+		ULOG_ERRNO("sem_init", -ret);
+		goto error;
+	}
+	self->sem_created = true;
+
+	ret = pthread_create(&self->thread, NULL, group_thread, self);
+	if (ret != 0) {
+		ULOG_ERRNO("pthread_create", ret);
+		ret = -ret;
+		goto error;
+	}
+	self->thread_launched = true;
+
+	*ret_obj = self;
+	return 0;
+
+error:
+	(void)araw_writer_group_destroy(self);
+	*ret_obj = NULL;
+	return ret;
+}
+
+
+int araw_writer_group_destroy(struct araw_writer_group *self)
+{
+	unsigned int count;
+
+	if (self == NULL)
+		return 0;
+
+	pthread_mutex_lock(&self->mutex);
+	count = self->writer_count;
+	pthread_mutex_unlock(&self->mutex);
+	ULOG_ERRNO_RETURN_ERR_IF(count > 0, EBUSY);
+
+	if (self->thread_launched) {
+		__atomic_store_n(&self->stop, 1, __ATOMIC_RELEASE);
+		sem_post(&self->sem);
+		pthread_join(self->thread, NULL);
+	}
+	if (self->sem_created)
+		sem_destroy(&self->sem);
+	pthread_mutex_destroy(&self->mutex);
+
+	free(self->writers);
+	free(self->iov);
+	free(self);
+	return 0;
+}
+
+
+int araw_writer_group_attach(struct araw_writer_group *group,
+			     struct araw_writer *writer)
+{
+	int ret = 0;
+	struct araw_writer **writers;
+	unsigned int capacity;
+
+	pthread_mutex_lock(&group->mutex);
+	if (group->writer_count == group->writer_capacity) {
+		capacity = group->writer_capacity > 0
+				   ? 2 * group->writer_capacity
+				   : 8;
+		writers = realloc(group->writers,
+				  capacity * sizeof(*group->writers));
+		if (writers == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		group->writers = writers;
+		group->writer_capacity = capacity;
+	}
+	group->writers[group->writer_count++] = writer;
+
+out:
+	pthread_mutex_unlock(&group->mutex);
+	return ret;
+}
+
+
+void araw_writer_group_detach(struct araw_writer_group *group,
+			      struct araw_writer *writer)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&group->mutex);
+	for (i = 0; i < group->writer_count; i++) {
+		if (group->writers[i] != writer)
+			continue;
+		memmove(&group->writers[i],
+			&group->writers[i + 1],
+			(group->writer_count - i - 1) *
+				sizeof(*group->writers));
+		group->writer_count--;
+		break;
+	}
+	if (group->next >= group->writer_count)
+		group->next = 0;
+	pthread_mutex_unlock(&group->mutex);
+}
+
+
+void araw_writer_group_notify(struct araw_writer_group *group)
+{
+	/* Post only once until the scheduler thread runs */
+	if (__atomic_exchange_n(&group->pending, 1, __ATOMIC_SEQ_CST) == 0)
+		sem_post(&group->sem);
+}
@@ -0,0 +1,531 @@
+/**
+ * Copyright (c) 2023 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <audio-raw/araw.h>
+
+#define ULOG_TAG araw_bench
+#include <ulog.h>
+ULOG_DECLARE_TAG(ULOG_TAG);
+
+
+#define DEFAULT_DIR "/tmp"
+#define DEFAULT_SIZE_MB 64
+#define DEFAULT_WRITE_BUF_SIZE (1024 * 1024)
+#define SAMPLE_RATE 48000
+
+
+struct bench_format {
+	const char *name;
+	enum araw_sample_format sample_format;
+	unsigned int bit_depth;
+};
+
+
+static const struct bench_format formats[] = {
+	{"s16", ARAW_SAMPLE_FORMAT_S16, 16},
+	{"s24", ARAW_SAMPLE_FORMAT_S24, 24},
+	{"s32", ARAW_SAMPLE_FORMAT_S32, 32},
+	{"f32", ARAW_SAMPLE_FORMAT_F32, 32},
+};
+
+
+static const unsigned int channel_counts[] = {1, 2, 8};
+
+
+static const unsigned int frame_lengths[] = {256, 1024, 4096};
+
+
+struct bench_case {
+	const struct bench_format *format;
+	unsigned int channel_count;
+	unsigned int frame_length;
+	size_t frame_size;
+	unsigned int frame_count;
+};
+
+
+/* Per-call latencies in nanoseconds */
+struct bench_stats {
+	uint64_t *latencies;
+	unsigned int count;
+	uint64_t total;
+	uint64_t bytes;
+};
+
+
+static const char short_options[] = "hd:s:f:c:l:w:";
+
+
+static const struct option long_options[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"dir", required_argument, NULL, 'd'},
+	{"size", required_argument, NULL, 's'},
+	{"format", required_argument, NULL, 'f'},
+	{"channels", required_argument, NULL, 'c'},
+	{"frame-length", required_argument, NULL, 'l'},
+	{"write-buf-size", required_argument, NULL, 'w'},
+	{0, 0, 0, 0},
+};
+
+
+static void usage(char *prog_name)
+{
+	/* clang-format off */
+	printf("Usage: %s [options]\n"
+	       "Options:\n"
+	       "  -h | --help                        "
+		       "Print this message\n"
+	       "  -d | --dir <path>                  "
+		       "Directory of the generated files (default: "
+		       DEFAULT_DIR ")\n"
+	       "  -s | --size <MiB>                  "
+		       "Size of the PCM data of each file (default: %d)\n"
+	       "  -f | --format <s16|s24|s32|f32>    "
+		       "Only benchmark this sample format\n"
+	       "  -c | --channels <count>            "
+		       "Only benchmark this channel count\n"
+	       "  -l | --frame-length <samples>      "
+		       "Only benchmark this frame length\n"
+	       "  -w | --write-buf-size <bytes>      "
+		       "Aggregation buffer size of the buffered writes "
+		       "(default: %d)\n"
+	       "\n",
+	       prog_name,
+	       DEFAULT_SIZE_MB,
+	       DEFAULT_WRITE_BUF_SIZE);
+	/* clang-format on */
+}
+
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static int stats_init(struct bench_stats *stats, unsigned int count)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->latencies = calloc(count, sizeof(*stats->latencies));
+	if (stats->latencies == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+
+static inline void
+stats_add(struct bench_stats *stats, uint64_t latency, size_t bytes)
+{
+	stats->latencies[stats->count++] = latency;
+	stats->total += latency;
+	stats->bytes += bytes;
+}
+
+
+static int u64_cmp(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *)a;
+	uint64_t vb = *(const uint64_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+
+static double stats_percentile(struct bench_stats *stats, double p)
+{
+	unsigned int i;
+
+	if (stats->count == 0)
+		return 0.;
+	i = (unsigned int)ceil(p / 100. * stats->count);
+	if (i > 0)
+		i--;
+	return stats->latencies[i] / 1000.;
+}
+
+
+static void stats_print(const struct bench_case *c,
+			const char *mode,
+			struct bench_stats *stats)
+{
+	char name[32];
+	double seconds = stats->total / 1e9;
+
+	qsort(stats->latencies,
+	      stats->count,
+	      sizeof(*stats->latencies),
+	      u64_cmp);
+
+	snprintf(name,
+		 sizeof(name),
+		 "%s/%uch/%u",
+		 c->format->name,
+		 c->channel_count,
+		 c->frame_length);
+	printf("%-16s %-10s %10.1f %12.0f %10.2f %10.2f %10.2f\n",
+	       name,
+	       mode,
+	       seconds > 0. ? stats->bytes / seconds / (1024. * 1024.) : 0.,
+	       seconds > 0. ? stats->count / seconds : 0.,
+	       stats_percentile(stats, 50.),
+	       stats_percentile(stats, 99.),
+	       stats_percentile(stats, 100.));
+}
+
+
+/* Fill a frame with a sine wave in the sample format */
+static void frame_fill(const struct bench_case *c, uint8_t *data)
+{
+	unsigned int i, ch;
+	size_t sample_size = c->format->bit_depth / 8;
+	double v;
+	int32_t iv;
+	float fv;
+	uint8_t *p = data;
+
+	for (i = 0; i < c->frame_length; i++) {
+		v = 0.5 * sin(2. * M_PI * 440. * i / SAMPLE_RATE);
+		for (ch = 0; ch < c->channel_count; ch++) {
+			if (c->format->sample_format == ARAW_SAMPLE_FORMAT_F32) {
+				fv = (float)v;
+				memcpy(p, &fv, sizeof(fv));
+			} else {
+				/* Little endian, left-justified */
+				iv = (int32_t)(v * 2147483647.);
+				iv >>= 32 - c->format->bit_depth;
+				memcpy(p, &iv, sample_size);
+			}
+			p += sample_size;
+		}
+	}
+}
+
+
+static int bench_write(const struct bench_case *c,
+		       const char *path,
+		       size_t write_buf_size,
+		       struct bench_stats *stats)
+{
+	int ret, err;
+	unsigned int i;
+	uint64_t start;
+	struct araw_writer *writer = NULL;
+	struct araw_writer_config config;
+	struct araw_frame frame;
+	uint8_t *data;
+
+	data = malloc(c->frame_size);
+	if (data == NULL)
+		return -ENOMEM;
+	frame_fill(c, data);
+
+	memset(&config, 0, sizeof(config));
+	config.format = adef_pcm_16b_48000hz_stereo;
+	config.format.channel_count = c->channel_count;
+	config.format.bit_depth = c->format->bit_depth;
+	config.sample_format = c->format->sample_format;
+	config.write_buf_size = write_buf_size;
+
+	ret = araw_writer_new(path, &config, &writer);
+	if (ret < 0) {
+		ULOG_ERRNO("araw_writer_new('%s')", -ret, path);
+		goto out;
+	}
+
+	memset(&frame, 0, sizeof(frame));
+	frame.cdata = data;
+	frame.cdata_length = c->frame_size;
+	frame.frame.format = config.format;
+
+	for (i = 0; i < c->frame_count; i++) {
+		start = time_ns();
+		ret = araw_writer_frame_write(writer, &frame);
+		stats_add(stats, time_ns() - start, c->frame_size);
+		if (ret < 0) {
+			ULOG_ERRNO("araw_writer_frame_write", -ret);
+			goto out;
+		}
+	}
+
+	/* The final flush and header update are part of the cost */
+	start = time_ns();
+	ret = araw_writer_destroy(writer);
+	writer = NULL;
+	stats->total += time_ns() - start;
+	if (ret < 0)
+		ULOG_ERRNO("araw_writer_destroy", -ret);
+
+out:
+	err = araw_writer_destroy(writer);
+	if (err < 0)
+		ULOG_ERRNO("araw_writer_destroy", -err);
+	free(data);
+	return ret;
+}
+
+
+/* Drop the file from the page cache, for cold-cache reads */
+static int cache_drop(const char *path)
+{
+	int ret = 0, fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ret = -errno;
+		ULOG_ERRNO("open('%s')", -ret, path);
+		return ret;
+	}
+
+	/* Dirty pages cannot be dropped */
+	if (fdatasync(fd) < 0) {
+		ret = -errno;
+		ULOG_ERRNO("fdatasync", -ret);
+		goto out;
+	}
+
+	ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	if (ret != 0) {
+		ULOG_ERRNO("posix_fadvise", ret);
+		ret = -ret;
+	}
+
+out:
+	close(fd);
+	return ret;
+}
+
+
+static int bench_read(const struct bench_case *c,
+		      const char *path,
+		      bool cold,
+		      struct bench_stats *stats)
+{
+	int ret, err;
+	uint64_t start;
+	struct araw_reader *reader = NULL;
+	struct araw_reader_config config;
+	struct araw_frame frame;
+	uint8_t *data;
+
+	data = malloc(c->frame_size);
+	if (data == NULL)
+		return -ENOMEM;
+
+	if (cold) {
+		ret = cache_drop(path);
+		if (ret < 0)
+			goto out;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.frame_length = c->frame_length;
+
+	ret = araw_reader_new(path, &config, &reader);
+	if (ret < 0) {
+		ULOG_ERRNO("araw_reader_new('%s')", -ret, path);
+		goto out;
+	}
+
+	while (1) {
+		start = time_ns();
+		ret = araw_reader_frame_read(reader, data, c->frame_size, &frame);
+		if (ret == -ENOENT) {
+			ret = 0;
+			break;
+		} else if (ret < 0) {
+			ULOG_ERRNO("araw_reader_frame_read", -ret);
+			goto out;
+		}
+		stats_add(stats, time_ns() - start, c->frame_size);
+	}
+
+out:
+	err = araw_reader_destroy(reader);
+	if (err < 0)
+		ULOG_ERRNO("araw_reader_destroy", -err);
+	free(data);
+	return ret;
+}
+
+
+static int bench_run(const struct bench_case *c,
+		     const char *dir,
+		     size_t write_buf_size)
+{
+	int ret;
+	char path[256];
+	struct bench_stats stats;
+
+	snprintf(path,
+		 sizeof(path),
+		 "%s/araw_bench_%s_%u_%u.wav",
+		 dir,
+		 c->format->name,
+		 c->channel_count,
+		 c->frame_length);
+
+	ret = stats_init(&stats, c->frame_count);
+	if (ret < 0)
+		return ret;
+
+	ret = bench_write(c, path, 0, &stats);
+	if (ret < 0)
+		goto out;
+	stats_print(c, "write", &stats);
+
+	stats.count = stats.total = stats.bytes = 0;
+	ret = bench_write(c, path, write_buf_size, &stats);
+	if (ret < 0)
+		goto out;
+	stats_print(c, "write-buf", &stats);
+
+	stats.count = stats.total = stats.bytes = 0;
+	ret = bench_read(c, path, false, &stats);
+	if (ret < 0)
+		goto out;
+	stats_print(c, "read-warm", &stats);
+
+	stats.count = stats.total = stats.bytes = 0;
+	ret = bench_read(c, path, true, &stats);
+	if (ret < 0)
+		goto out;
+	stats_print(c, "read-cold", &stats);
+
+out:
+	unlink(path);
+	free(stats.latencies);
+	return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+	int ret, idx, c;
+	size_t f, ch, l;
+	const char *dir = DEFAULT_DIR;
+	const char *format_name = NULL;
+	unsigned int channel_count = 0, frame_length = 0;
+	size_t size = DEFAULT_SIZE_MB * 1024 * 1024;
+	size_t write_buf_size = DEFAULT_WRITE_BUF_SIZE;
+	struct bench_case bc;
+
+	while ((c = getopt_long(
+			argc, argv, short_options, long_options, &idx)) != -1) {
+		switch (c) {
+		case 0:
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 10) * 1024 * 1024;
+			break;
+		case 'f':
+			format_name = optarg;
+			break;
+		case 'c':
+			channel_count = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			frame_length = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			write_buf_size = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+			break;
+		}
+	}
+
+	if (size == 0 || write_buf_size == 0) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%-16s %-10s %10s %12s %10s %10s %10s\n",
+	       "case",
+	       "mode",
+	       "MiB/s",
+	       "frames/s",
+	       "p50 (us)",
+	       "p99 (us)",
+	       "max (us)");
+
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		if (format_name != NULL &&
+		    strcmp(format_name, formats[f].name) != 0)
+			continue;
+		for (ch = 0; ch < sizeof(channel_counts) / sizeof(*channel_counts);
+		     ch++) {
+			if (channel_count != 0 &&
+			    channel_count != channel_counts[ch])
+				continue;
+			for (l = 0; l < sizeof(frame_lengths) /
+						sizeof(frame_lengths[0]);
+			     l++) {
+				if (frame_length != 0 &&
+				    frame_length != frame_lengths[l])
+					continue;
+				bc.format = &formats[f];
+				bc.channel_count = channel_counts[ch];
+				bc.frame_length = frame_lengths[l];
+				bc.frame_size = (size_t)bc.frame_length *
+						bc.channel_count *
+						(bc.format->bit_depth / 8);
+				bc.frame_count = size / bc.frame_size;
+				if (bc.frame_count == 0)
+					bc.frame_count = 1;
+				ret = bench_run(&bc, dir, write_buf_size);
+				if (ret < 0)
+					exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	exit(EXIT_SUCCESS);
+}